@@ -0,0 +1,405 @@
+///////////////////////////////////////////////////////////////////////
+// archive.cpp -- Content addressed, deduplicated archive of dumps
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "archive.hpp"
+#include "updecode.hpp"
+#include "digest.hpp"
+#include "ppzfile.hpp"
+
+#include <atomic>
+#include <thread>
+
+static std::atomic<unsigned> tmp_seq(0);	// Unique temporaries, across threads
+
+static std::string
+sha256_of(const unsigned char *data,size_t n) {
+	s_sha256 sha;
+	unsigned char d[32];
+
+	sha.update(data,n);
+	sha.final(d);
+	return hex_string(d,sizeof d);
+}
+
+//////////////////////////////////////////////////////////////////////
+// <store>/<kind>/<xx>/<sha256>, creating the directories when mkdirs
+//////////////////////////////////////////////////////////////////////
+
+static std::string
+object_path(const char *store,const char *kind,const std::string& sha,bool mkdirs) {
+	std::string dir = std::string(store) + "/" + kind + "/" + sha.substr(0,2);
+
+	if ( mkdirs ) {
+		mkdir(store,0777);
+		mkdir((std::string(store) + "/" + kind).c_str(),0777);
+		mkdir(dir.c_str(),0777);
+	}
+	return dir + "/" + sha;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write a file under a temporary name and rename it into place, so
+// that an object is either whole or absent (two threads storing the
+// same object just both rename the same bytes into place). The data
+// is synced before the rename and the directory after it, as for
+// close_output(), so a crash cannot leave a named but empty object.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+put_file(const std::string& path,const void *data,size_t n) {
+	std::string tmp = path + "." + std::to_string(long(getpid())) + "." + std::to_string(++tmp_seq) + ".tmp";
+	FILE *f = fopen(tmp.c_str(),"w");
+	bool ok;
+
+	ok = f && fwrite(data,1,n,f) == n && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	if ( f )
+		ok = fclose(f) == 0 && ok;
+	if ( !ok || rename(tmp.c_str(),path.c_str()) == -1 ) {
+		fprintf(stderr,"%s: Writing %s\n",strerror(errno),path.c_str());
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	int dfd = ::open(path.substr(0,path.rfind('/')).c_str(),O_RDONLY);
+
+	if ( dfd != -1 ) {
+		fsync(dfd);
+		::close(dfd);
+	}
+	return true;
+}
+
+static bool
+read_file(const std::string& path,std::vector<unsigned char>& data) {
+	FILE *f = fopen(path.c_str(),"r");
+	unsigned char buf[65536];
+	size_t n;
+
+	data.clear();
+	if ( !f )
+		return false;
+	while ( (n = fread(buf,1,sizeof buf,f)) > 0 )
+		data.insert(data.end(),buf,buf + n);
+	fclose(f);
+	return true;
+}
+
+bool
+archive_seen(const char *store,const std::string& sha256) {
+	struct stat st;
+
+	return stat(object_path(store,"images",sha256,false).c_str(),&st) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Archive an image: its chunks not yet stored, then its manifest
+//////////////////////////////////////////////////////////////////////
+
+bool
+archive_put(const char *store,const s_eprom_type& etype,const std::vector<unsigned char>& image,const char *source,s_archived& res) {
+	unsigned chunk = etype.segsize > 0 ? etype.segsize : image.size();
+	std::string manifest;
+	char line[128];
+
+	res.sha256 = sha256_of(image.data(),image.size());
+	res.seen = archive_seen(store,res.sha256);
+	res.chunks = res.fresh = 0;
+	res.fresh_bytes = 0;
+	if ( res.seen )
+		return true;
+
+	snprintf(line,sizeof line,"prompro-manifest 1 %s %u %u\n",
+		etype.name.c_str(),
+		unsigned(image.size()),
+		chunk);
+	manifest = line;
+	manifest += std::string("source ") + source + "\n";
+
+	for ( size_t off = 0; off < image.size(); off += chunk ) {
+		size_t n = image.size() - off < chunk ? image.size() - off : chunk;
+		std::string sha = sha256_of(image.data() + off,n);
+		std::string cpath = object_path(store,"chunks",sha,true);
+
+		if ( access(cpath.c_str(),F_OK) != 0 ) {
+			if ( !put_file(cpath,image.data() + off,n) )
+				return false;
+			res.fresh++;
+			res.fresh_bytes += n;
+		}
+		res.chunks++;
+
+		snprintf(line,sizeof line,"%lu ",(unsigned long)off);
+		manifest += line + sha + "\n";
+	}
+
+	return put_file(object_path(store,"images",res.sha256,true),manifest.data(),manifest.size());
+}
+
+bool
+archive_manifest(const char *store,const std::string& sha256,s_manifest& m) {
+	std::string path = object_path(store,"images",sha256,false);
+	FILE *f = fopen(path.c_str(),"r");
+	char line[1024], name[128];
+	unsigned version;
+
+	m.chunks.clear();
+	m.source.clear();
+	if ( !f )
+		return false;
+
+	if ( !fgets(line,sizeof line,f)
+	  || sscanf(line,"prompro-manifest %u %127s %u %u",&version,name,&m.size,&m.chunk) != 4
+	  || version != 1 || m.chunk == 0 ) {
+		fclose(f);
+		fprintf(stderr,"%s: not a prompro manifest\n",path.c_str());
+		return false;
+	}
+	m.etype = name;
+
+	while ( fgets(line,sizeof line,f) ) {
+		char sha[65];
+		unsigned long off;
+
+		line[strcspn(line,"\n")] = 0;
+		if ( !strncmp(line,"source ",7) )
+			m.source = line + 7;
+		else if ( sscanf(line,"%lu %64s",&off,sha) == 2 && off == (unsigned long)m.chunks.size() * m.chunk )
+			m.chunks.push_back(sha);
+	}
+	fclose(f);
+
+	if ( (unsigned long)m.chunks.size() * m.chunk < m.size ) {
+		fprintf(stderr,"%s: manifest is missing chunks\n",path.c_str());
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Rebuild an image from its chunks, checking every hash on the way
+//////////////////////////////////////////////////////////////////////
+
+bool
+archive_get(const char *store,const std::string& sha256,s_manifest& m,std::vector<unsigned char>& image) {
+	std::vector<unsigned char> data;
+
+	if ( !archive_manifest(store,sha256,m) )
+		return false;
+
+	image.clear();
+	for ( auto it = m.chunks.begin(); it != m.chunks.end(); ++it ) {
+		std::string cpath = object_path(store,"chunks",*it,false);
+
+		if ( !read_file(cpath,data) || sha256_of(data.data(),data.size()) != *it ) {
+			fprintf(stderr,"%s: chunk missing or damaged\n",cpath.c_str());
+			return false;
+		}
+		image.insert(image.end(),data.begin(),data.end());
+	}
+
+	if ( image.size() != m.size || sha256_of(image.data(),image.size()) != sha256 ) {
+		fprintf(stderr,"Archived image %s does not rebuild to its hash\n",sha256.c_str());
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read an image file of this EPROM type: binary, Intel HEX, .ppz or
+// the upload text -d writes by default (decoded segment by segment,
+// as convert_dump() does)
+//////////////////////////////////////////////////////////////////////
+
+static const char *
+read_image(const char *path,const s_eprom_type& etype,std::vector<unsigned char>& image) {
+	std::vector<unsigned char> data;
+	unsigned size = image_size(etype);
+	e_imgfmt fmt = imgfmt_from_path(path);
+
+	if ( fmt == FMT_PPZ ) {
+		s_ppzfile ppz;
+		const char *why = ppz.open(path);
+
+		if ( why )
+			return why;
+		if ( ppz.size != size )
+			return "not the size of the EPROM type";
+		image.resize(size);
+		if ( !ppz.read(0,size,image.data()) )
+			return "damaged ppz segment";
+		return 0;
+	}
+
+	if ( !read_file(path,data) )
+		return strerror(errno);
+
+	switch ( fmt ) {
+	case FMT_BIN:
+		if ( data.size() != size )
+			return "not the size of the EPROM type";
+		image.swap(data);
+		return 0;
+	case FMT_IHEX:
+		{
+			s_updecoder dec;
+
+			image.assign(size,0xFF);
+			dec.begin(image.data(),0,size);
+			dec.feed((const char *)data.data(),data.size());
+			dec.feed('\n');
+			if ( !dec.complete() )
+				return "Intel HEX does not cover the EPROM type cleanly";
+		}
+		return 0;
+	case FMT_TEXT:
+		{
+			const char *text = (const char *)data.data();
+			s_updecoder dec;
+			size_t pos = 0;
+
+			image.assign(size,0xFF);
+			for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+				dec.begin(image.data() + it->offset,it->offset,etype.segsize);
+				pos += dec.feed(text + pos,data.size() - pos);
+				if ( !dec.complete() )
+					return "upload text does not hold every segment cleanly";
+			}
+		}
+		return 0;
+	default:
+		return "only binary, Intel HEX, upload text and ppz images can be archived";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Import image files, hashed and stored on a thread per CPU. Returns
+// nonzero if any file could not be imported.
+//////////////////////////////////////////////////////////////////////
+
+struct s_import {
+	const char	*why;		// Failure, else null
+	s_archived	res;
+};
+
+static void
+import_files(const char *store,const s_eprom_type *etype,const std::vector<std::string> *files,std::vector<s_import> *done,std::atomic<unsigned> *next) {
+	std::vector<unsigned char> image;
+	unsigned x;
+
+	while ( (x = (*next)++) < files->size() ) {
+		s_import& imp = (*done)[x];
+		const char *path = (*files)[x].c_str();
+
+		if ( (imp.why = read_image(path,*etype,image)) == 0
+		  && !archive_put(store,*etype,image,path,imp.res) )
+			imp.why = "could not be stored";
+	}
+}
+
+int
+archive_import(const char *store,const s_eprom_type& etype,const std::vector<std::string>& files) {
+	std::vector<s_import> done(files.size());
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> next(0);
+	unsigned nthreads = std::thread::hardware_concurrency();
+	double t0 = now_secs();
+
+	if ( nthreads < 1 )
+		nthreads = 1;
+	if ( nthreads > files.size() )
+		nthreads = files.size();
+
+	for ( unsigned t = 0; t < nthreads; ++t )
+		workers.push_back(std::thread(import_files,store,&etype,&files,&done,&next));
+	for ( auto it = workers.begin(); it != workers.end(); ++it )
+		it->join();
+
+	double secs = now_secs() - t0;
+	unsigned fresh = 0, seen = 0, failed = 0, chunks = 0, fresh_chunks = 0;
+	unsigned long bytes = 0, fresh_bytes = 0;
+
+	for ( size_t x = 0; x < files.size(); ++x ) {
+		const s_import& imp = done[x];
+
+		if ( imp.why ) {
+			fprintf(stderr,"%s: %s\n",files[x].c_str(),imp.why);
+			++failed;
+			continue;
+		}
+		if ( imp.res.seen ) {
+			++seen;
+			if ( verbose )
+				printf("%s: %s seen before\n",files[x].c_str(),imp.res.sha256.c_str());
+		} else	{
+			++fresh;
+			if ( verbose )
+				printf("%s: %s new, %u of %u chunks stored\n",
+					files[x].c_str(),
+					imp.res.sha256.c_str(),
+					imp.res.fresh,
+					imp.res.chunks);
+		}
+		chunks += imp.res.chunks;
+		fresh_chunks += imp.res.fresh;
+		bytes += image_size(etype);
+		fresh_bytes += imp.res.fresh_bytes;
+	}
+
+	printf("Imported %u files (%u new images, %u seen before, %u failed) in %.2f secs on %u threads\n",
+		unsigned(files.size()),
+		fresh,
+		seen,
+		failed,
+		secs,
+		nthreads);
+	if ( bytes > 0 )
+		printf("  %lu image bytes, %lu stored in %u new chunks (%.1f%%); %.1f MB/s\n",
+			bytes,
+			fresh_bytes,
+			fresh_chunks,
+			100.0 * fresh_bytes / bytes,
+			secs > 0.0 ? bytes / secs / 1e6 : 0.0);
+	return failed ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Has the image in path been archived? Returns 0 if so, else 1.
+//////////////////////////////////////////////////////////////////////
+
+int
+archive_lookup(const char *store,const s_eprom_type& etype,const char *path) {
+	std::vector<unsigned char> image;
+	const char *why = read_image(path,etype,image);
+	s_manifest m;
+
+	if ( why ) {
+		fprintf(stderr,"%s: %s\n",path,why);
+		return 1;
+	}
+
+	std::string sha = sha256_of(image.data(),image.size());
+
+	if ( !archive_seen(store,sha) ) {
+		printf("%s: not archived (%s)\n",path,sha.c_str());
+		return 1;
+	}
+
+	archive_manifest(store,sha,m);
+	printf("%s: archived as %s, first from %s\n",
+		path,
+		sha.c_str(),
+		m.source != "" ? m.source.c_str() : "?");
+	return 0;
+}
+
+// End archive.cpp
@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////
+// archive.hpp -- Content addressed, deduplicated archive of dumps
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <string>
+#include <vector>
+
+#include "prompro.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// An archive directory holds images split into chunks of one segment
+// size (segment aligned), each stored once under its SHA-256:
+//
+//	chunks/<xx>/<sha256>	Chunk bytes (xx: first two hex digits)
+//	images/<xx>/<sha256>	Manifest of the image with that SHA-256
+//
+// A manifest is a few lines of text:
+//
+//	prompro-manifest 1 <eprom type> <image size> <chunk size>
+//	source <path it was first archived from>
+//	<offset> <chunk sha256>
+//	...
+//
+// The image SHA-256 is the one in <path>.digest files, so asking if
+// an image has been seen before is one stat() of its manifest.
+//////////////////////////////////////////////////////////////////////
+
+struct s_manifest {
+	std::string	etype;		// EPROM type name
+	unsigned	size;		// Image size
+	unsigned	chunk;		// Chunk size
+	std::string	source;		// First archived from
+	std::vector<std::string> chunks; // Chunk SHA-256, in address order
+};
+
+struct s_archived {
+	std::string	sha256;		// Of the whole image
+	bool		seen;		// Was archived already
+	unsigned	chunks;		// Chunks in the image
+	unsigned	fresh;		// Of those, stored by this call
+	unsigned long	fresh_bytes;
+};
+
+bool archive_put(const char *store,const s_eprom_type& etype,const std::vector<unsigned char>& image,const char *source,s_archived& res);
+bool archive_seen(const char *store,const std::string& sha256);
+bool archive_manifest(const char *store,const std::string& sha256,s_manifest& m);
+bool archive_get(const char *store,const std::string& sha256,s_manifest& m,std::vector<unsigned char>& image);
+
+int archive_import(const char *store,const s_eprom_type& etype,const std::vector<std::string>& files);
+int archive_lookup(const char *store,const s_eprom_type& etype,const char *path);
+
+#endif // ARCHIVE_HPP
+
+// End archive.hpp
@@ -0,0 +1,702 @@
+///////////////////////////////////////////////////////////////////////
+// bench.cpp -- Serial throughput benchmark for the Prompro-8 transport
+//
+// Runs the real open_unit()/readch()/writech()/get_prompt() and
+// download_file() code against a fake PROMPRO-8 served on a pty by a
+// child process. The fake paces its output to the selected baud rate
+// (11 bits per character), so the numbers reflect what the host does
+// while the line is the bottleneck.
+//
+// With -H it instead measures the hex decode kernels and the upload
+// decoder on large in-memory dumps, and with -P checks the segment
+// planner.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#include "prompro.hpp"
+#include "hexcodec.hpp"
+#include "updecode.hpp"
+#include "vote.hpp"
+#include "segplan.hpp"
+
+#include <string>
+#include <vector>
+
+struct s_fakecfg {
+	unsigned	baud;		// Pacing rate (0 = as fast as the pty goes)
+	unsigned	segsize;	// Bytes sent per U command
+	bool		blank;		// Serve an erased chip (all 0xFF)
+	unsigned	weak;		// One weak bit per weak bytes (0: none)
+	unsigned	faults;		// Damage every faults'th upload (0: none)
+	bool		plain;		// Upload plain hex lines, not Intel HEX
+};
+
+//////////////////////////////////////////////////////////////////////
+// Deterministic EPROM content served by the fake programmer
+//////////////////////////////////////////////////////////////////////
+
+static unsigned char
+fake_byte(unsigned addr) {
+	return (unsigned char)((addr * 7) ^ (addr >> 8));
+}
+
+static void
+fake_upload(std::string& out,unsigned base,unsigned size,bool blank=false,unsigned weak=0,bool plain=false) {
+	static const char hex[] = "0123456789ABCDEF";
+
+	for ( unsigned a = base; a < base + size; a += 16 ) {
+		unsigned n = base + size - a < 16 ? base + size - a : 16;
+		unsigned char rec[4+16];
+		unsigned sum = 0;
+
+		rec[0] = n;
+		rec[1] = (a >> 8) & 0xFF;
+		rec[2] = a & 0xFF;
+		rec[3] = 0;
+		for ( unsigned x=0; x<n; ++x ) {
+			rec[4+x] = blank ? 0xFF : fake_byte(a + x);
+			if ( weak && (a + x) % weak == weak / 2 && rand() % 3 == 0 )
+				rec[4+x] ^= 0x10;	// Weak bit: misreads a third of the time
+		}
+
+		if ( plain ) {			// "00 01 .. 0F", no address or checksum
+			for ( unsigned x=0; x<n; ++x ) {
+				if ( x > 0 )
+					out += ' ';
+				out += hex[rec[4+x] >> 4];
+				out += hex[rec[4+x] & 0x0F];
+			}
+			out += "\r\n";
+			continue;
+		}
+
+		out += ':';
+		for ( unsigned x=0; x<4+n; ++x ) {
+			out += hex[rec[x] >> 4];
+			out += hex[rec[x] & 0x0F];
+			sum += rec[x];
+		}
+		sum = (0x100 - (sum & 0xFF)) & 0xFF;
+		out += hex[sum >> 4];
+		out += hex[sum & 0x0F];
+		out += "\r\n";
+	}
+	if ( !plain )
+		out += ":00000001FF\r\n";
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve the PROMPRO-8 command set on the pty master until it closes
+//////////////////////////////////////////////////////////////////////
+
+static void
+fake_serve(int fd,const s_fakecfg& cfg) {
+	double rate = cfg.baud > 0 ? double(cfg.baud) / bits_per_char() : 0.0;
+	std::string line, outq;
+	double credit_t = now_secs();
+	double credit = 0.0;
+	unsigned uploads = 0;
+
+	for (;;) {
+		struct pollfd pfd;
+		int rc;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN | (outq.empty() ? 0 : POLLOUT);
+		pfd.revents = 0;
+
+		rc = poll(&pfd,1,outq.empty() || rate <= 0.0 ? -1 : 10);
+		if ( rc < 0 && errno != EINTR )
+			return;
+
+		if ( pfd.revents & POLLIN ) {
+			char buf[256];
+			int n = read(fd,buf,sizeof buf);
+
+			if ( n <= 0 )
+				return;
+
+			for ( int x=0; x<n; ++x ) {
+				char ch = buf[x];
+
+				if ( ch == 0x1B ) {		// ESC: abort
+					outq = "\r\n*";
+					line.clear();
+					continue;
+				}
+
+				if ( ch != '\r' ) {
+					outq += ch;		// Echo
+					line += ch;
+					continue;
+				}
+
+				outq += "\r\n";
+				std::string cmd;
+
+				cmd.swap(line);
+				if ( cmd.size() >= 5 && cmd[0] == 'U' ) {
+					unsigned a = strtoul(cmd.c_str()+1,0,16);
+					std::string up;
+
+					// From a to the end of its segment
+					fake_upload(up,a,cfg.segsize - a % cfg.segsize,cfg.blank,cfg.weak,cfg.plain);
+
+					// Faults alternate: a bad record checksum, then a stall
+					if ( cfg.faults && ++uploads % cfg.faults == 0 ) {
+						if ( uploads / cfg.faults % 2 ) {
+							up[9] = up[9] == '0' ? '1' : '0';
+						} else	{
+							outq += up.substr(0,up.size() / 2);
+							continue;	// No more until ESC
+						}
+					}
+					outq += up;
+				}
+				outq += '*';
+			}
+		} else if ( pfd.revents & (POLLHUP|POLLERR) ) {
+			return;
+		}
+
+		if ( outq.empty() ) {
+			credit = 0.0;
+			credit_t = now_secs();
+			continue;
+		}
+
+		size_t n = outq.size();
+
+		if ( rate > 0.0 ) {
+			double t = now_secs();
+
+			credit += (t - credit_t) * rate;
+			credit_t = t;
+			if ( credit < 1.0 )
+				continue;
+			if ( n > size_t(credit) )
+				n = size_t(credit);
+		}
+
+		int wrc = write(fd,outq.data(),n);
+
+		if ( wrc > 0 ) {
+			outq.erase(0,wrc);
+			if ( rate > 0.0 )
+				credit -= wrc;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start a fake programmer on a new pty. Returns the child pid, and
+// the slave fd (kept open so the master never sees a hangup).
+//////////////////////////////////////////////////////////////////////
+
+static pid_t
+fake_start(const s_fakecfg& cfg,std::string& slave_name,int& slave_fd) {
+	int master;
+	char name[256];
+
+	if ( openpty(&master,&slave_fd,name,0,0) < 0 ) {
+		fprintf(stderr,"%s: openpty()\n",strerror(errno));
+		exit(2);
+	}
+
+	slave_name = name;
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if ( pid < 0 ) {
+		fprintf(stderr,"%s: fork()\n",strerror(errno));
+		exit(2);
+	}
+
+	if ( pid == 0 ) {
+		close(slave_fd);
+		fake_serve(master,cfg);
+		_exit(0);
+	}
+
+	close(master);
+	return pid;
+}
+
+struct s_result {
+	unsigned	baud;
+	unsigned	size;
+	double		secs;
+	unsigned long	payload;
+	unsigned long	wire;
+	unsigned long	syscalls;
+	double		cpu_user;
+	double		cpu_sys;
+	long		wakeups;	// Voluntary context switches
+};
+
+static double
+tv_secs(const struct timeval& tv) {
+	return double(tv.tv_sec) + double(tv.tv_usec) / 1e6;
+}
+
+static s_result
+bench_one(unsigned baud,unsigned size,unsigned segsize) {
+	s_fakecfg cfg;
+	std::string name;
+	int slave_fd;
+	s_unit u;
+	s_eprom_type etype;
+	s_result res;
+	char path[] = "/tmp/ppbenchXXXXXX";
+	struct rusage ru0, ru1;
+
+	cfg.baud = baud;
+	cfg.segsize = segsize < size ? segsize : size;
+	cfg.blank = false;
+	cfg.weak = 0;
+	cfg.faults = 0;
+	cfg.plain = false;
+
+	pid_t pid = fake_start(cfg,name,slave_fd);
+
+	u.name = name;
+	u.device = name;
+	u.baud_rate = baud > 0 ? baud : 115200;
+	u.keepalive_ms = 0;
+
+	etype.name = "bench";
+	etype.segsize = cfg.segsize;
+	for ( unsigned off = 0; off < size; off += cfg.segsize ) {
+		s_segment seg;
+
+		seg.ppname = off == 0 ? "12" : "13";
+		seg.offset = off;
+		seg.base = off;
+		etype.segs.push_back(seg);
+	}
+
+	int tfd = mkstemp(path);
+
+	if ( tfd < 0 ) {
+		fprintf(stderr,"%s: mkstemp()\n",strerror(errno));
+		exit(2);
+	}
+	close(tfd);
+
+	if ( !open_unit(u) )
+		exit(4);
+
+	fflush(stdout);
+	int saved = dup(1);
+	int devnull = open("/dev/null",O_WRONLY);
+
+	dup2(devnull,1);
+	close(devnull);
+
+	getrusage(RUSAGE_SELF,&ru0);
+	double t0 = now_secs();
+
+	download_file(u,etype,path,FMT_TEXT);
+
+	double t1 = now_secs();
+	getrusage(RUSAGE_SELF,&ru1);
+
+	fflush(stdout);
+	dup2(saved,1);
+	close(saved);
+
+	res.baud = baud;
+	res.size = size;
+	res.secs = t1 - t0;
+	res.payload = 0;
+	res.wire = 0;
+	res.syscalls = 0;
+	for ( auto it = u.wirestats.begin(); it != u.wirestats.end(); ++it ) {
+		if ( it->first == "CR" )
+			continue;			// Port open, not the transfer
+		res.payload += it->second.payload;
+		res.wire += it->second.tx + it->second.rx;
+		res.syscalls += it->second.syscalls;
+	}
+	res.cpu_user = tv_secs(ru1.ru_utime) - tv_secs(ru0.ru_utime);
+	res.cpu_sys = tv_secs(ru1.ru_stime) - tv_secs(ru0.ru_stime);
+	res.wakeups = ru1.ru_nvcsw - ru0.ru_nvcsw;
+
+	close(u.fd);
+	close(slave_fd);
+	kill(pid,SIGTERM);
+	waitpid(pid,0,0);
+	unlink(path);
+
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Microbenchmark of the hex decode kernels and the upload decoder
+//////////////////////////////////////////////////////////////////////
+
+static void
+bench_hex(unsigned mbytes) {
+	static const char hex[] = "0123456789ABCDEFabcdef";
+	size_t nchars = size_t(mbytes) << 20;
+	std::string text(nchars,'0');
+	std::vector<unsigned char> ref(nchars / 2), out(nchars / 2);
+	const char *kernels[] = { "scalar", "sse2", "avx2" };
+
+	srand(1);
+	for ( size_t x = 0; x < nchars; ++x )
+		text[x] = hex[rand() % 22];
+
+	hex_decode_kernel("scalar")(text.data(),nchars,ref.data());
+
+	printf("%-8s %10s %10s %s\n","Kernel","MB/s in","MB/s out","Check");
+	for ( unsigned k = 0; k < sizeof kernels / sizeof kernels[0]; ++k ) {
+		hex_decode_fn fn = hex_decode_kernel(kernels[k]);
+		const unsigned reps = 8;
+
+		if ( !fn ) {
+			printf("%-8s %10s\n",kernels[k],"n/a");
+			continue;
+		}
+
+		bool ok = fn(text.data(),nchars,out.data()) && out == ref;
+		double t0 = now_secs();
+
+		for ( unsigned r = 0; r < reps; ++r )
+			fn(text.data(),nchars,out.data());
+
+		double secs = now_secs() - t0;
+
+		printf("%-8s %10.1f %10.1f %s\n",
+			kernels[k],
+			reps * nchars / secs / 1e6,
+			reps * nchars / 2 / secs / 1e6,
+			ok ? "ok" : "MISMATCH");
+	}
+
+	// Majority vote over 9 reads of an mb/2 megabyte image
+
+	const unsigned npass = 9;
+	size_t vbytes = nchars / 4;
+	std::vector<std::vector<unsigned char> > passes(npass,std::vector<unsigned char>(vbytes));
+	std::vector<const unsigned char *> pp;
+	std::vector<unsigned char> vref(vbytes), uref(vbytes), vout(vbytes), uout(vbytes);
+
+	for ( unsigned p = 0; p < npass; ++p ) {
+		for ( size_t x = 0; x < vbytes; ++x )
+			passes[p][x] = rand() % 50 ? fake_byte(x) : rand();
+		pp.push_back(passes[p].data());
+	}
+	vote_kernel("scalar")(pp.data(),npass,vbytes,vref.data(),uref.data());
+
+	for ( unsigned k = 0; k < sizeof kernels / sizeof kernels[0]; ++k ) {
+		vote_fn fn = vote_kernel(kernels[k]);
+		const unsigned reps = 8;
+
+		if ( !fn ) {
+			printf("v:%-6s %10s\n",kernels[k],"n/a");
+			continue;
+		}
+
+		fn(pp.data(),npass,vbytes,vout.data(),uout.data());
+		bool ok = vout == vref && uout == uref;
+		double t0 = now_secs();
+
+		for ( unsigned r = 0; r < reps; ++r )
+			fn(pp.data(),npass,vbytes,vout.data(),uout.data());
+
+		double secs = now_secs() - t0;
+
+		printf("v:%-6s %10.1f %10.1f %s (vote of %u reads)\n",
+			kernels[k],
+			reps * npass * double(vbytes) / secs / 1e6,
+			reps * double(vbytes) / secs / 1e6,
+			ok ? "ok" : "MISMATCH",
+			npass);
+	}
+
+	// A 64K image as uploaded text, decoded through s_updecoder
+
+	const unsigned isize = 65536;
+	std::string dump;
+	std::vector<unsigned char> image(isize);
+	s_updecoder dec;
+	unsigned reps = 0;
+
+	fake_upload(dump,0,isize);
+	dump += '*';
+
+	double t0 = now_secs(), secs;
+
+	do	{
+		dec.begin(image.data(),0,isize);
+		dec.feed(dump.data(),dump.size());
+		++reps;
+		secs = now_secs() - t0;
+	} while ( secs < 1.0 );
+
+	bool ok = dec.complete();
+
+	for ( unsigned a = 0; a < isize && ok; ++a )
+		ok = image[a] == fake_byte(a);
+
+	printf("%-8s %10.1f %10.1f %s (Intel HEX upload, %s kernel)\n",
+		"updecode",
+		reps * dump.size() / secs / 1e6,
+		reps * double(isize) / secs / 1e6,
+		ok && dec.valid() ? "ok" : "MISMATCH",
+		hex_decode_best());
+
+	// The same image as a plain hex upload (no EOF record) must be valid
+
+	dump = "U0000\r\n";
+	fake_upload(dump,0,isize,false,0,true);
+	dump += '*';
+
+	t0 = now_secs();
+	reps = 0;
+	do	{
+		dec.begin(image.data(),0,isize);
+		dec.feed(dump.data(),dump.size());
+		++reps;
+		secs = now_secs() - t0;
+	} while ( secs < 1.0 );
+
+	ok = dec.valid();
+	for ( unsigned a = 0; a < isize && ok; ++a )
+		ok = image[a] == fake_byte(a);
+
+	printf("%-8s %10.1f %10.1f %s (plain hex upload%s%s)\n",
+		"updecode",
+		reps * dump.size() / secs / 1e6,
+		reps * double(isize) / secs / 1e6,
+		ok ? "ok" : "MISMATCH",
+		dec.fault() ? ": " : "",
+		dec.fault() ? dec.fault() : "");
+}
+
+//////////////////////////////////////////////////////////////////////
+// Plan a 64K part from overlapping windows of a 32K buffer: A loads
+// 0x0000 (24K), B 0x4000 and C 0x8000. B and C are entered past their
+// load address, so their segments must still relocate to it, and
+// every address must fall inside the buffer its code loads.
+//////////////////////////////////////////////////////////////////////
+
+static int
+bench_plan() {
+	static const struct {
+		const char	*ppname;
+		unsigned	offset, size;
+	} codes[] = {
+		{ "A", 0x0000, 0x6000 }, { "B", 0x4000, 0x8000 }, { "C", 0x8000, 0x8000 },
+	};
+	s_programmer prog;
+	s_eprom_type etype;
+	bool ok;
+
+	prog.buffer = 0x8000;
+	for ( unsigned x = 0; x < sizeof codes / sizeof codes[0]; ++x ) {
+		s_typecode code;
+
+		code.ppname = codes[x].ppname;
+		code.part = 0;
+		code.offset = codes[x].offset;
+		code.size = codes[x].size;
+		prog.codes.push_back(code);
+	}
+	etype.name = "overlap";
+
+	ok = plan_segments(prog,0x10000,etype);
+	for ( auto it = etype.segs.begin(); ok && it != etype.segs.end(); ++it ) {
+		unsigned x = it->ppname[0] - 'A';
+
+		if ( it->base != codes[x].offset || it->offset < it->base
+		  || it->offset + etype.segsize > it->base + codes[x].size ) {
+			printf("segplan  segment %s at 0x%04X relocated to 0x%04X, loads 0x%04X\n",
+				it->title.c_str(),
+				it->offset,
+				it->base,
+				codes[x].offset);
+			ok = false;
+		}
+	}
+
+	printf("segplan  %u segments of %u bytes %s (overlapping windows)\n",
+		unsigned(etype.segs.size()),
+		etype.segsize,
+		ok ? "ok" : "MISMATCH");
+	return ok ? 0 : 1;
+}
+
+static std::vector<unsigned>
+parse_list(const char *arg) {
+	std::vector<unsigned> v;
+	char *ep;
+
+	for (;;) {
+		v.push_back(strtoul(arg,&ep,0));
+		if ( *ep != ',' )
+			break;
+		arg = ep + 1;
+	}
+	return v;
+}
+
+static void
+usage() {
+
+	fputs(	"Usage: ppbench [-b bauds] [-s sizes] [-S segsize] [-F [-E] [-W n] [-X n] [-p]] [-H mb] [-P] [-h]\n"
+		"where:\n"
+		"\t-b bauds\tComma separated baud rates (0 = unpaced pty)\n"
+		"\t-s sizes\tComma separated chip sizes in bytes\n"
+		"\t-S segsize\tPROMPRO segment size (default 16384)\n"
+		"\t-F\t\tOnly serve a fake PROMPRO-8 (first baud), print its pty\n"
+		"\t-E\t\tThe served chip is blank (erased)\n"
+		"\t-W n\t\tThe served chip has a weak bit every n bytes\n"
+		"\t-X n\t\tDamage every n'th upload (a bad checksum or a stall)\n"
+		"\t-p\t\tUpload plain hex lines instead of Intel HEX\n"
+		"\t-H mb\t\tBenchmark hex decoding of an mb megabyte dump instead\n"
+		"\t-P\t\tCheck the segment planner on overlapping type codes\n"
+		"\t-h\t\tThis info\n",
+		stdout);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	std::vector<unsigned> bauds = parse_list("19200,57600,115200,0");
+	std::vector<unsigned> sizes = parse_list("2048,8192");
+	unsigned segsize = 16384;
+	bool serve_only = false, blank = false, plain = false, plan = false;
+	unsigned weak = 0, faults = 0;
+	unsigned hex_mb = 0;
+	int optch;
+
+	while ( (optch = getopt(argc,argv,":b:s:S:FEW:X:pH:Ph")) != -1 ) {
+		switch ( optch ) {
+		case 'b':
+			bauds = parse_list(optarg);
+			break;
+		case 's':
+			sizes = parse_list(optarg);
+			break;
+		case 'S':
+			segsize = strtoul(optarg,0,0);
+			break;
+		case 'F':
+			serve_only = true;
+			break;
+		case 'E':
+			blank = true;
+			break;
+		case 'W':
+			weak = strtoul(optarg,0,0);
+			break;
+		case 'X':
+			faults = strtoul(optarg,0,0);
+			break;
+		case 'p':
+			plain = true;
+			break;
+		case 'H':
+			hex_mb = strtoul(optarg,0,0);
+			break;
+		case 'P':
+			plan = true;
+			break;
+		case 'h':
+			usage();
+			break;
+		default:
+			fprintf(stderr,"Invalid option -%c\n",optopt);
+			exit(1);
+		}
+	}
+
+	if ( plan )
+		return bench_plan();
+
+	if ( hex_mb > 0 ) {
+		bench_hex(hex_mb);
+		return 0;
+	}
+
+	if ( serve_only ) {
+		s_fakecfg cfg;
+		std::string name;
+		int slave_fd;
+
+		cfg.baud = bauds[0];
+		cfg.segsize = segsize;
+		cfg.blank = blank;
+		cfg.weak = weak;
+		cfg.faults = faults;
+		cfg.plain = plain;
+		pid_t pid = fake_start(cfg,name,slave_fd);
+
+		printf("%s\n",name.c_str());
+		fflush(stdout);
+		waitpid(pid,0,0);
+		return 0;
+	}
+
+	printf("%-7s %7s %8s %9s %7s %7s %9s %8s %8s %8s %8s\n",
+		"Baud","Size","Secs","Bytes/s","Line%","Wire/B","Sysc/B",
+		"CPU ms","CPU us/B","Wakeups","Wake/KB");
+
+	for ( auto si = sizes.begin(); si != sizes.end(); ++si ) {
+		for ( auto bi = bauds.begin(); bi != bauds.end(); ++bi ) {
+			s_result r = bench_one(*bi,*si,segsize);
+			double cpu = r.cpu_user + r.cpu_sys;
+			double rate = r.secs > 0.0 ? r.payload / r.secs : 0.0;
+			double limit = r.baud > 0 ? double(r.baud) / bits_per_char() : 0.0;
+			char baud[16], line[16];
+
+			if ( r.baud > 0 ) {
+				snprintf(baud,sizeof baud,"%u",r.baud);
+				snprintf(line,sizeof line,"%.1f",100.0 * (r.wire / r.secs) / limit);
+			} else	{
+				strcpy(baud,"pty");
+				strcpy(line,"-");
+			}
+
+			printf("%-7s %7u %8.3f %9.1f %7s %7.2f %9.2f %8.1f %8.2f %8ld %8.1f\n",
+				baud,
+				r.size,
+				r.secs,
+				rate,
+				line,
+				r.payload ? double(r.wire) / r.payload : 0.0,
+				r.payload ? double(r.syscalls) / r.payload : 0.0,
+				cpu * 1e3,
+				r.payload ? cpu * 1e6 / r.payload : 0.0,
+				r.wakeups,
+				r.payload ? r.wakeups * 1024.0 / r.payload : 0.0);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+}
+
+// End bench.cpp
@@ -0,0 +1,352 @@
+///////////////////////////////////////////////////////////////////////
+// digest.cpp -- Incremental CRC32 and SHA-256
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_X86 1
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "digest.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// CRC-32: slicing-by-8 tables for the reflected polynomial 0xEDB88320
+//////////////////////////////////////////////////////////////////////
+
+static uint32_t crctab[8][256];
+
+static bool
+init_crctab() {
+
+	for ( unsigned x = 0; x < 256; ++x ) {
+		uint32_t c = x;
+
+		for ( int k = 0; k < 8; ++k )
+			c = c & 1 ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+		crctab[0][x] = c;
+	}
+	for ( unsigned x = 0; x < 256; ++x )
+		for ( int t = 1; t < 8; ++t )
+			crctab[t][x] = (crctab[t-1][x] >> 8) ^ crctab[0][crctab[t-1][x] & 0xFF];
+	return true;
+}
+
+static bool crctab_ready = init_crctab();
+
+static uint32_t
+crc32_table(uint32_t crc,const unsigned char *p,size_t n) {
+
+	(void)crctab_ready;
+	for ( ; n >= 8; p += 8, n -= 8 ) {
+		uint32_t one = (p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24) ^ crc;
+		uint32_t two = p[4] | p[5] << 8 | p[6] << 16 | uint32_t(p[7]) << 24;
+
+		crc = crctab[7][one & 0xFF] ^ crctab[6][(one >> 8) & 0xFF]
+		    ^ crctab[5][(one >> 16) & 0xFF] ^ crctab[4][one >> 24]
+		    ^ crctab[3][two & 0xFF] ^ crctab[2][(two >> 8) & 0xFF]
+		    ^ crctab[1][(two >> 16) & 0xFF] ^ crctab[0][two >> 24];
+	}
+	while ( n-- > 0 )
+		crc = (crc >> 8) ^ crctab[0][(crc ^ *p++) & 0xFF];
+	return crc;
+}
+
+#ifdef CRC_X86
+
+//////////////////////////////////////////////////////////////////////
+// Carry-less multiply folding (Intel, "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ"): four 128-bit lanes fold 64
+// bytes per step, then fold to 128 and 64 bits and Barrett reduce.
+// Requires n >= 64 and a multiple of 16.
+//////////////////////////////////////////////////////////////////////
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+crc32_pclmul(uint32_t crc,const unsigned char *buf,size_t n) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL,0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL,0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0,0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL,0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0,0,~0,0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1,_mm_cvtsi32_si128(int(crc)));
+	buf += 64;
+	n -= 64;
+
+	for ( ; n >= 64; buf += 64, n -= 64 ) {
+		x5 = _mm_clmulepi64_si128(x1,k1k2,0x00);
+		x6 = _mm_clmulepi64_si128(x2,k1k2,0x00);
+		x7 = _mm_clmulepi64_si128(x3,k1k2,0x00);
+		x8 = _mm_clmulepi64_si128(x4,k1k2,0x00);
+		x1 = _mm_clmulepi64_si128(x1,k1k2,0x11);
+		x2 = _mm_clmulepi64_si128(x2,k1k2,0x11);
+		x3 = _mm_clmulepi64_si128(x3,k1k2,0x11);
+		x4 = _mm_clmulepi64_si128(x4,k1k2,0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,x5),_mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2,x6),_mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3,x7),_mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4,x8),_mm_loadu_si128((const __m128i *)(buf + 0x30)));
+	}
+
+	// Fold the four lanes into one
+
+	x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+	x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x3),x5);
+	x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x4),x5);
+
+	for ( ; n >= 16; buf += 16, n -= 16 ) {
+		x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+		x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,_mm_loadu_si128((const __m128i *)buf)),x5);
+	}
+
+	// 128 -> 64 bits
+
+	x2 = _mm_clmulepi64_si128(x1,k3k4,0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1,8),x2);
+	x0 = k5k0;
+	x2 = _mm_srli_si128(x1,4);
+	x1 = _mm_and_si128(x1,mask32);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	// Barrett reduction to 32 bits
+
+	x2 = _mm_and_si128(x1,mask32);
+	x2 = _mm_clmulepi64_si128(x2,poly,0x10);
+	x2 = _mm_and_si128(x2,mask32);
+	x2 = _mm_clmulepi64_si128(x2,poly,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	return uint32_t(_mm_extract_epi32(x1,1));
+}
+
+static bool
+have_pclmul() {
+	static const bool have = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+
+	return have;
+}
+
+#endif // CRC_X86
+
+#if defined(__ARM_FEATURE_CRC32)
+
+static uint32_t
+crc32_armv8(uint32_t crc,const unsigned char *p,size_t n) {
+
+	for ( ; n >= 8; p += 8, n -= 8 ) {
+		uint64_t v;
+
+		memcpy(&v,p,8);
+		crc = __crc32d(crc,v);
+	}
+	while ( n-- > 0 )
+		crc = __crc32b(crc,*p++);
+	return crc;
+}
+
+#endif
+
+void
+s_crc32::update(const void *data,size_t n) {
+	const unsigned char *p = (const unsigned char *)data;
+
+#if defined(__ARM_FEATURE_CRC32)
+	state = crc32_armv8(state,p,n);
+	return;
+#else
+#ifdef CRC_X86
+	if ( n >= 64 && have_pclmul() ) {
+		size_t chunk = n & ~size_t(15);
+
+		state = crc32_pclmul(state,p,chunk);
+		p += chunk;
+		n -= chunk;
+	}
+#endif
+	state = crc32_table(state,p,n);
+#endif
+}
+
+const char *
+crc32_kernel() {
+
+#if defined(__ARM_FEATURE_CRC32)
+	return "armv8";
+#else
+#ifdef CRC_X86
+	if ( have_pclmul() )
+		return "pclmul";
+#endif
+	return "table";
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// SHA-256
+//////////////////////////////////////////////////////////////////////
+
+static const uint32_t sha_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t
+ror(uint32_t x,unsigned n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static void
+sha256_block(uint32_t h[8],const unsigned char *p) {
+	uint32_t w[64], a, b, c, d, e, f, g, hh;
+
+	for ( int t = 0; t < 16; ++t, p += 4 )
+		w[t] = uint32_t(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	for ( int t = 16; t < 64; ++t ) {
+		uint32_t s0 = ror(w[t-15],7) ^ ror(w[t-15],18) ^ (w[t-15] >> 3);
+		uint32_t s1 = ror(w[t-2],17) ^ ror(w[t-2],19) ^ (w[t-2] >> 10);
+
+		w[t] = w[t-16] + s0 + w[t-7] + s1;
+	}
+
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+	for ( int t = 0; t < 64; ++t ) {
+		uint32_t t1 = hh + (ror(e,6) ^ ror(e,11) ^ ror(e,25)) + ((e & f) ^ (~e & g)) + sha_k[t] + w[t];
+		uint32_t t2 = (ror(a,2) ^ ror(a,13) ^ ror(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void
+s_sha256::init() {
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(h,iv,sizeof h);
+	length = 0;
+	nbuf = 0;
+}
+
+void
+s_sha256::update(const void *data,size_t n) {
+	const unsigned char *p = (const unsigned char *)data;
+
+	length += n;
+
+	if ( nbuf > 0 ) {
+		size_t take = 64 - nbuf < n ? 64 - nbuf : n;
+
+		memcpy(buf + nbuf,p,take);
+		nbuf += take;
+		p += take;
+		n -= take;
+		if ( nbuf < 64 )
+			return;
+		sha256_block(h,buf);
+		nbuf = 0;
+	}
+
+	for ( ; n >= 64; p += 64, n -= 64 )
+		sha256_block(h,p);
+
+	memcpy(buf,p,n);
+	nbuf = n;
+}
+
+void
+s_sha256::final(unsigned char digest[32]) {
+	uint64_t bits = length * 8;
+	unsigned char pad[72];
+	size_t npad = (nbuf < 56 ? 56 : 120) - nbuf;
+
+	memset(pad,0,sizeof pad);
+	pad[0] = 0x80;
+	for ( int x = 0; x < 8; ++x )
+		pad[npad + x] = (unsigned char)(bits >> (56 - 8 * x));
+	update(pad,npad + 8);
+
+	for ( int x = 0; x < 8; ++x ) {
+		digest[4*x+0] = h[x] >> 24;
+		digest[4*x+1] = h[x] >> 16;
+		digest[4*x+2] = h[x] >> 8;
+		digest[4*x+3] = h[x];
+	}
+}
+
+std::string
+hex_string(const unsigned char *data,size_t n) {
+	static const char digits[] = "0123456789abcdef";
+	std::string s;
+
+	for ( size_t x = 0; x < n; ++x ) {
+		s += digits[data[x] >> 4];
+		s += digits[data[x] & 0x0F];
+	}
+	return s;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Image digests
+//////////////////////////////////////////////////////////////////////
+
+void
+s_imgdigest::advance(const unsigned char *image,size_t upto) {
+
+	if ( upto <= done )
+		return;
+	crc.update(image + done,upto - done);
+	sha.update(image + done,upto - done);
+	done = upto;
+}
+
+std::string
+s_imgdigest::crc32_hex() {
+	char buf[16];
+
+	snprintf(buf,sizeof buf,"%08x",crc.final());
+	return buf;
+}
+
+std::string
+s_imgdigest::sha256_hex() {
+	unsigned char d[32];
+
+	sha.final(d);
+	return hex_string(d,sizeof d);
+}
+
+// End digest.cpp
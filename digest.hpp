@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////
+// digest.hpp -- Incremental CRC32 and SHA-256
+///////////////////////////////////////////////////////////////////////
+
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+//////////////////////////////////////////////////////////////////////
+// CRC-32 (IEEE 802.3, as zlib/PNG/cksum -o3). Uses PCLMULQDQ folding
+// on x86 or the ARMv8 CRC32 instructions when the CPU has them, else
+// slicing-by-8 tables.
+//////////////////////////////////////////////////////////////////////
+
+struct s_crc32 {
+	uint32_t	state;
+
+	s_crc32() { init(); }
+	void init() { state = 0xFFFFFFFFu; }
+	void update(const void *data,size_t n);
+	uint32_t final() const { return ~state; }
+};
+
+const char *crc32_kernel();		// "pclmul", "armv8" or "table"
+
+//////////////////////////////////////////////////////////////////////
+// SHA-256 (FIPS 180-4)
+//////////////////////////////////////////////////////////////////////
+
+struct s_sha256 {
+	uint32_t	h[8];
+	uint64_t	length;		// Bytes hashed
+	unsigned char	buf[64];	// Partial block
+	unsigned	nbuf;
+
+	s_sha256() { init(); }
+	void init();
+	void update(const void *data,size_t n);
+	void final(unsigned char digest[32]);
+};
+
+std::string hex_string(const unsigned char *data,size_t n);
+
+//////////////////////////////////////////////////////////////////////
+// Both digests over an image that is filled in as it arrives: bytes
+// are hashed, in address order, once they are final.
+//////////////////////////////////////////////////////////////////////
+
+struct s_imgdigest {
+	s_crc32		crc;
+	s_sha256	sha;
+	size_t		done;		// Image bytes hashed so far
+
+	s_imgdigest() : done(0) {}
+	void reset() { crc.init(); sha.init(); done = 0; }
+	void advance(const unsigned char *image,size_t upto);
+	std::string crc32_hex();
+	std::string sha256_hex();	// Only once, after all bytes are in
+};
+
+#endif // DIGEST_HPP
+
+// End digest.hpp
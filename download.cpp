@@ -0,0 +1,886 @@
+///////////////////////////////////////////////////////////////////////
+// download.cpp -- Upload an EPROM image from a Prompro-8 unit
+// Date: Sun Feb  8 16:34:07 2015  (C) Warren W. Gay VE3WWG
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+
+#include "prompro.hpp"
+#include "perfmon.hpp"
+#include "updecode.hpp"
+#include "imgfmt.hpp"
+#include "digest.hpp"
+#include "journal.hpp"
+#include "ppzfile.hpp"
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+unsigned upload_retries = 2;			// Re-reads of a segment that fails validation
+
+//////////////////////////////////////////////////////////////////////
+// Size of the flat image covering all of an EPROM type's segments
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+image_size(const s_eprom_type& etype) {
+	unsigned size = 0;
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it )
+		if ( it->offset + etype.segsize > size )
+			size = it->offset + etype.segsize;
+	return size;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Load one segment into the PROMPRO buffer and upload it, decoding
+// into image + seg.offset as the characters arrive. The raw upload
+// text is appended to *text when text is not null. A nonzero skip
+// starts the upload that many bytes into the segment. Every load is
+// relocated to seg.base, so U always takes chip addresses, whatever
+// the last read left behind. Returns false if watch aborted the
+// upload, or an owned unit stopped answering (u.healthy is then
+// false).
+// An upload that stalls is cut off and the unit resynced; dec is
+// then left without its prompt (see s_updecoder::valid()).
+//////////////////////////////////////////////////////////////////////
+
+bool
+upload_segment(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,s_updecoder& dec,std::string *text,s_upwatch *watch,unsigned skip) {
+
+	if ( !select_type(u,seg) || !load(u) || !relocate(u,seg.base) )
+		return false;			// Owned unit lost
+	return upload_buffer(u,etype,seg,image,dec,text,watch,skip);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Upload from a buffer already loaded with seg and relocated to
+// seg.base, as for upload_segment().
+//////////////////////////////////////////////////////////////////////
+
+bool
+upload_buffer(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,s_updecoder& dec,std::string *text,s_upwatch *watch,unsigned skip) {
+	bool aborted = false;
+	char cmd[32];
+	int ch;
+
+	u.quiet = true;			// No -D trace of the upload itself
+
+	const char *phase = perf_phase("upload");
+
+	dec.begin(image + seg.offset,seg.offset,etype.segsize);
+	dec.next = skip;			// Plain hex lines start here
+
+	wire_begin(u,"U");
+	sprintf(cmd,"U%04X\r",seg.offset + skip);
+	writech(u,cmd);
+
+	for (;;) {
+		ch = readch(u,5000);
+		if ( ch == -1 ) {
+			fprintf(stderr,"\nWARNING: upload of segment %s stalled at %u bytes\n",
+				seg.ppname.c_str(),
+				dec.filled);
+			if ( !abort_upload(u) )
+				timeout(u,"Resyncing after a stalled upload");
+			break;
+		}
+		if ( text )
+			*text += char(ch);
+		if ( u.echo )
+			putchar(ch);
+		if ( dec.feed(ch) )
+			break;
+		if ( watch && (ch == '\r' || ch == '\n') && !watch->progress(seg,dec) ) {
+			aborted = true;
+			if ( !abort_upload(u) )
+				timeout(u,"Aborting upload");
+			break;
+		}
+	}
+
+	u.wire->payload += dec.filled;
+	wire_end(u);
+
+	perf_phase(phase);
+	u.quiet = false;
+
+	if ( verbose )
+		printf("\nSegment %s: %u of %u bytes, %u records, %u checksum errors, %u bad records\n",
+			seg.title.c_str(),
+			dec.filled,
+			dec.size,
+			dec.records,
+			dec.bad_sums,
+			dec.bad_records);
+
+	if ( aborted ) {
+		if ( verbose )
+			printf("Upload of segment %s aborted at %u bytes\n",seg.title.c_str(),dec.filled);
+		return false;
+	}
+
+	if ( !dec.valid(skip) )
+		fprintf(stderr,"WARNING: segment %s (offset 0x%04X) decoded %u of %u bytes with %u errors: %s\n",
+			seg.ppname.c_str(),
+			seg.offset,
+			dec.filled,
+			dec.size - skip,
+			dec.errors(),
+			dec.fault(skip));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Output goes to a temporary file next to path, which is flushed to
+// disk and renamed over path once complete: path only ever holds a
+// whole image (the old one, until the new one is in). Temporaries of
+// outputs still open are removed at exit, and on SIGINT, SIGTERM or
+// SIGHUP. The handler may run at any point, so the names it unlinks
+// sit in a fixed table it can walk without a lock.
+//////////////////////////////////////////////////////////////////////
+
+struct s_output {
+	std::string	path;
+	std::string	tmp;		// Written here until published
+	s_imgwriter	*writer;
+};
+
+static const unsigned max_temps = 256;		// Outputs open at once
+
+static std::mutex tmp_mx;
+static char *tmp_names[max_temps];		// Outputs not yet published
+static volatile sig_atomic_t tmp_used[max_temps];
+
+static void
+remove_temps() {
+	std::lock_guard<std::mutex> lock(tmp_mx);
+
+	for ( unsigned x = 0; x < max_temps; ++x )
+		if ( tmp_used[x] ) {
+			tmp_used[x] = 0;
+			unlink(tmp_names[x]);
+		}
+}
+
+static void
+temps_signal(int sig) {
+
+	for ( unsigned x = 0; x < max_temps; ++x )
+		if ( tmp_used[x] )
+			unlink(tmp_names[x]);
+	signal(sig,SIG_DFL);
+	raise(sig);			// Die of it as if never caught
+}
+
+static void
+catch_signals() {
+	static const int sigs[] = { SIGINT, SIGTERM, SIGHUP };
+	struct sigaction sa, old;
+
+	memset(&sa,0,sizeof sa);
+	sa.sa_handler = temps_signal;
+	sigemptyset(&sa.sa_mask);
+
+	for ( unsigned x = 0; x < sizeof sigs / sizeof sigs[0]; ++x )
+		if ( sigaction(sigs[x],0,&old) == 0 && old.sa_handler == SIG_DFL )
+			sigaction(sigs[x],&sa,0);	// Leave ignored signals ignored
+}
+
+//////////////////////////////////////////////////////////////////////
+// Register a temporary (tmp_mx held). The name is in place before
+// the slot is marked used, so the handler never sees half of it.
+// Returns false when the table is full.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+temp_add(const std::string& tmp) {
+
+	for ( unsigned x = 0; x < max_temps; ++x )
+		if ( !tmp_used[x] ) {
+			free(tmp_names[x]);
+			tmp_names[x] = strdup(tmp.c_str());
+			tmp_used[x] = 1;
+			return true;
+		}
+	return false;
+}
+
+static void
+temp_drop(const std::string& tmp) {
+
+	for ( unsigned x = 0; x < max_temps; ++x )
+		if ( tmp_used[x] && tmp == tmp_names[x] ) {
+			tmp_used[x] = 0;
+			return;
+		}
+}
+
+static void
+open_output(s_output& out,const char *path,e_imgfmt fmt,unsigned size,FILE *msg) {
+	FILE *dfile = 0;
+	bool added;
+	int fd;
+
+	{
+		std::lock_guard<std::mutex> lock(tmp_mx);
+		static unsigned seq = 0;
+		char sfx[48];
+
+		if ( seq == 0 ) {
+			atexit(remove_temps);
+			catch_signals();
+		}
+		snprintf(sfx,sizeof sfx,".%ld.%u.tmp",long(getpid()),++seq);
+		out.tmp = std::string(path) + sfx;
+		added = temp_add(out.tmp);
+	}
+	if ( !added ) {
+		fprintf(stderr,"More than %u outputs open at once\n",max_temps);
+		exit(2);
+	}
+	out.path = path;
+
+	if ( (fd = ::open(out.tmp.c_str(),O_RDWR|O_CREAT|O_EXCL,0666)) == -1 || !(dfile = fdopen(fd,"w+")) ) {
+		fprintf(stderr,"%s: Opening file %s for write.\n",
+			strerror(errno),
+			out.tmp.c_str());
+		exit(2);
+	}
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+
+	if ( verbose )
+		fprintf(msg,"Writing %s image to file '%s'\n",imgfmt_name(fmt),path);
+
+	out.writer = imgwriter_new(fmt,dfile,size);
+}
+
+static void
+close_output(s_output& out) {
+	FILE *dfile = out.writer->out;
+	bool ok;
+
+	ok = out.writer->finish();
+	delete out.writer;
+	out.writer = 0;
+
+	ok = ok && fflush(dfile) == 0 && !ferror(dfile) && fsync(fileno(dfile)) == 0;
+	ok = fclose(dfile) == 0 && ok;
+	if ( !ok || rename(out.tmp.c_str(),out.path.c_str()) == -1 ) {
+		fprintf(stderr,"%s: Writing file %s\n",
+			strerror(errno),
+			out.path.c_str());
+		exit(2);			// remove_temps() cleans up
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tmp_mx);
+
+		temp_drop(out.tmp);
+	}
+
+	// Make the rename itself durable
+
+	size_t slash = out.path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : out.path.substr(0,slash);
+	int dfd = ::open(dir.c_str(),O_RDONLY);
+
+	if ( dfd != -1 ) {
+		fsync(dfd);
+		::close(dfd);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Hash a segment's leading bytes as they arrive, once everything
+// below the segment is final, and journal them every journal_chunk
+// bytes
+//////////////////////////////////////////////////////////////////////
+
+struct s_digestwatch : s_upwatch {
+	s_imgdigest		digest;
+	const unsigned char	*image;
+	s_journal		*journal;
+	unsigned		x;		// Index of the segment uploading
+	unsigned		upto;		// Bytes of it in, from the start
+
+	s_digestwatch(const unsigned char *image,s_journal *journal) : image(image), journal(journal), x(0), upto(0) {}
+
+	bool progress(const s_segment& seg,const s_updecoder& dec) {
+		if ( digest.done >= seg.offset )
+			digest.advance(image,seg.offset + dec.contig);
+		while ( upto < dec.size && dec.have[upto] )
+			++upto;
+		if ( upto >= journal->saved[x] + journal_chunk )
+			journal->save(x,seg,image,upto);
+		return true;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Advance the digest over every byte that is now final: gaps between
+// segments (left erased) and finished segments, stopping at the first
+// segment still to come.
+//////////////////////////////////////////////////////////////////////
+
+static void
+digest_final(s_imgdigest& digest,const s_eprom_type& etype,const std::vector<bool>& finished,const std::vector<unsigned char>& image) {
+	size_t pos = digest.done;
+
+	while ( pos < image.size() ) {
+		size_t next = image.size();
+		unsigned x = 0;
+		bool stop = false;
+
+		for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it, ++x ) {
+			if ( pos >= it->offset && pos < it->offset + etype.segsize ) {
+				if ( !finished[x] )
+					stop = true;
+				else	next = it->offset + etype.segsize;
+				break;
+			}
+			if ( it->offset > pos && it->offset < next )
+				next = it->offset;	// Gap runs up to here
+		}
+		if ( stop )
+			break;
+		pos = next;
+	}
+	digest.advance(image.data(),pos);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Report the image digests (to msg) and record them in <path>.digest
+//////////////////////////////////////////////////////////////////////
+
+static void
+write_digests(const char *path,s_imgdigest& digest,size_t size,FILE *msg) {
+	std::string crc = digest.crc32_hex(), sha = digest.sha256_hex();
+	std::string dpath = std::string(path) + ".digest";
+	const char *base = strrchr(path,'/');
+	FILE *dfile;
+
+	base = base ? base + 1 : path;
+
+	fprintf(msg,"CRC32 (%s) = %s\n",base,crc.c_str());
+	fprintf(msg,"SHA256 (%s) = %s\n",base,sha.c_str());
+	if ( verbose )
+		fprintf(msg,"CRC32 kernel: %s\n",crc32_kernel());
+
+	if ( !(dfile = fopen(dpath.c_str(),"w")) ) {
+		fprintf(stderr,"%s: Opening file %s for write.\n",
+			strerror(errno),
+			dpath.c_str());
+		return;
+	}
+	fprintf(dfile,"# Digests of the decoded %lu byte EPROM image\n",(unsigned long)size);
+	fprintf(dfile,"CRC32 (%s) = %s\n",base,crc.c_str());
+	fprintf(dfile,"SHA256 (%s) = %s\n",base,sha.c_str());
+	fclose(dfile);
+}
+
+//////////////////////////////////////////////////////////////////////
+// A whole chip read in progress. Each segment upload is validated
+// (record checksums, all bytes present, the EOF record and prompt)
+// and a failed segment alone is loaded and uploaded again, up to
+// upload_retries times. A segment that follows one of the same type
+// is uploaded from the buffer already loaded, without another L.
+//////////////////////////////////////////////////////////////////////
+
+struct s_chipread {
+	s_unit&			u;
+	const s_eprom_type&	etype;
+	std::vector<unsigned char> image;
+	s_journal		journal;
+	s_digestwatch		watch;
+	s_updecoder		dec;
+	std::string		loaded;		// Type in the buffer, if reusable
+	bool			restart;	// Hashed bytes were rewritten
+	bool			clean;		// Every segment validated
+
+	s_chipread(s_unit& u,const s_eprom_type& etype) : u(u), etype(etype),
+		image(image_size(etype),0xFF), watch(image.data(),&journal),
+		restart(false), clean(true) {
+		journal.saved.assign(etype.segs.size(),0);
+	}
+
+	bool segment(unsigned x,std::string& text);
+};
+
+//////////////////////////////////////////////////////////////////////
+// Read segment x (from the bytes the journal has on), with its upload
+// text in text. Returns false if it was still bad.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_chipread::segment(unsigned x,std::string& text) {
+	const s_segment& seg = etype.segs[x];
+	unsigned skip = journal.saved[x];
+
+	if ( skip > 0 )
+		printf("Segment %s: %u of %u bytes from the journal\n",
+			seg.title.c_str(),
+			skip,
+			etype.segsize);
+
+	for ( unsigned tries = 0; skip < etype.segsize; ) {
+		text.clear();
+		watch.x = x;
+		watch.upto = skip;
+		if ( skip == 0 && tries == 0 && loaded == seg.ppname ) {
+			if ( verbose )
+				printf("Segment %s: uploading from the %s buffer already loaded\n",
+					seg.title.c_str(),
+					seg.ppname.c_str());
+			upload_buffer(u,etype,seg,image.data(),dec,&text,&watch);
+		} else	{
+			upload_segment(u,etype,seg,image.data(),dec,&text,&watch,skip);
+		}
+		if ( !u.healthy ) {
+			clean = false;		// Owned unit lost: no point retrying
+			return false;
+		}
+		if ( dec.changed || tries > 0 || skip > 0 )
+			restart = true;
+		if ( dec.valid(skip) ) {
+			loaded = seg.ppname;	// Only a whole upload vouches for the buffer
+			journal.save(x,seg,image.data(),etype.segsize);
+			return true;
+		}
+		loaded.clear();
+		if ( !dec.done )
+			u.prompro_type.clear();	// Unit may have reset: select again
+		if ( tries++ >= upload_retries ) {
+			fprintf(stderr,"WARNING: segment %s still bad after %u retries, written as read: %s\n",
+				seg.ppname.c_str(),
+				upload_retries,
+				dec.fault(skip));
+			clean = false;
+			return false;
+		}
+		fprintf(stderr,"Retrying segment %s (%u of %u): %s\n",
+			seg.ppname.c_str(),
+			tries,
+			upload_retries,
+			dec.fault(skip));
+		u.wirestats["U"].retries++;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Download the whole chip to path, validating and retrying segments
+// as for s_chipread. When keep is not null, the image is returned in
+// it if every segment decoded cleanly (else it is left empty).
+// Returns false if a segment was still bad when written.
+//
+// Progress is journaled next to path (except for text output, which
+// needs the raw upload). With resume, a journal left by an earlier
+// run is picked up if the chip matches it: saved segments are not
+// read again, and a partly saved one is read from where it stopped.
+// Segments are read in the configured order, or in order (segment
+// indexes) when given.
+//////////////////////////////////////////////////////////////////////
+
+bool
+download_file(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,std::vector<unsigned char> *keep,bool resume,const std::vector<unsigned> *order) {
+	const char *phase = perf_phase("write");
+	s_chipread rd(u,etype);
+	std::vector<unsigned char>& image = rd.image;
+	s_journal& journal = rd.journal;
+	bool resumed = false;
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+
+	if ( fmt == FMT_TEXT ) {
+		if ( resume )
+			fputs("WARNING: text output cannot be resumed: reading the whole chip\n",stderr);
+	} else	{
+		if ( resume && journal.load(etype,path,image.data()) ) {
+			if ( journal_matches(u,etype,journal,image.data()) ) {
+				resumed = true;
+			} else	{
+				fputs("WARNING: the chip does not match the journal: reading the whole chip\n",stderr);
+				image.assign(image.size(),0xFF);
+			}
+		} else if ( resume ) {
+			fprintf(stderr,"WARNING: no journal for %s: reading the whole chip\n",path);
+		}
+		journal.start(etype,path,resumed);
+	}
+
+	s_output out;
+
+	open_output(out,path,fmt,image.size(),stdout);
+
+	std::string text;			// Upload text of one segment
+	std::vector<bool> finished(etype.segs.size(),false);
+	s_imgdigest& digest = rd.watch.digest;
+
+	if ( verbose )
+		printf("Downloading EPROM to file '%s'\n",
+			path);
+
+	for ( unsigned k = 0; k < etype.segs.size(); ++k ) {
+		unsigned x = order ? (*order)[k] : k;
+
+		digest_final(digest,etype,finished,image);
+		rd.segment(x,text);
+		finished[x] = true;
+
+		perf_phase("write");
+		out.writer->segment(etype.segs[x].offset,image.data() + etype.segs[x].offset,etype.segsize,text);
+	}
+
+	close_output(out);
+
+	if ( !verbose )
+		putchar('\n');			// End the last upload's echo line
+	if ( rd.restart )
+		digest.reset();
+	digest.advance(image.data(),image.size());
+	write_digests(path,digest,image.size(),stdout);
+	perf_phase(phase);
+
+	if ( rd.clean )
+		journal.remove();
+	else if ( journal.log )
+		printf("Journal kept: rerun with --resume to read the bad segments again\n");
+
+	if ( keep ) {
+		keep->clear();
+		if ( rd.clean )
+			keep->swap(image);
+	}
+	return rd.clean;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Batches split a download in two, so that the output of one chip
+// can be written and hashed (on another thread) while the operator
+// changes chips: read_chip() does the device work, journaled as for
+// download_file(), and save_chip() writes the files. save_chip()
+// sends its messages to msg, and leaves perf_phase() alone.
+//////////////////////////////////////////////////////////////////////
+
+bool
+read_chip(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,const std::vector<unsigned> *order,s_chipimage& chip) {
+	const char *phase = perf_phase("read");
+	s_chipread rd(u,etype);
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+	if ( fmt != FMT_TEXT )
+		rd.journal.start(etype,path,false);
+
+	chip.text.assign(etype.segs.size(),std::string());
+	chip.order.clear();
+	for ( unsigned k = 0; k < etype.segs.size(); ++k ) {
+		unsigned x = order ? (*order)[k] : k;
+
+		if ( !rd.segment(x,chip.text[x]) && !u.healthy )
+			break;			// Lost the (owned) unit
+		chip.order.push_back(x);
+	}
+	if ( !verbose && u.echo )
+		putchar('\n');
+
+	chip.image.swap(rd.image);
+	chip.clean = rd.clean;
+	perf_phase(phase);
+	return chip.clean;
+}
+
+void
+save_chip(const s_eprom_type& etype,const s_chipimage& chip,const char *path,e_imgfmt fmt,FILE *msg) {
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+
+	s_output out;
+	s_imgdigest digest;
+
+	open_output(out,path,fmt,chip.image.size(),msg);
+
+	for ( auto it = chip.order.begin(); it != chip.order.end(); ++it ) {
+		const s_segment& seg = etype.segs[*it];
+
+		out.writer->segment(seg.offset,chip.image.data() + seg.offset,etype.segsize,chip.text[*it]);
+	}
+	close_output(out);
+
+	digest.advance(chip.image.data(),chip.image.size());
+	write_digests(path,digest,chip.image.size(),msg);
+
+	if ( chip.clean )
+		journal_discard(path);
+	else if ( fmt != FMT_TEXT )
+		fprintf(msg,"Journal kept: rerun with -d %s --resume to read the bad segments again\n",path);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write an image already in memory (e.g. from the cache) to path.
+// The text format needs the raw upload, so it cannot be written.
+//////////////////////////////////////////////////////////////////////
+
+bool
+write_image(const s_eprom_type& etype,const unsigned char *image,const char *path,e_imgfmt fmt) {
+	unsigned size = image_size(etype);
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+	if ( fmt == FMT_TEXT )
+		return false;
+
+	const char *phase = perf_phase("write");
+	s_output out;
+	s_imgdigest digest;
+
+	open_output(out,path,fmt,size,stdout);
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it )
+		out.writer->segment(it->offset,image + it->offset,etype.segsize,std::string());
+	close_output(out);
+
+	digest.advance(image,size);
+	write_digests(path,digest,size,stdout);
+	perf_phase(phase);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Ends a segment's upload as soon as the wanted window of it is in
+//////////////////////////////////////////////////////////////////////
+
+struct s_windowwatch : s_upwatch {
+	unsigned	from;		// First window byte not yet received
+	unsigned	to;		// End of the window in this segment
+
+	s_windowwatch(unsigned from,unsigned to) : from(from), to(to) {}
+
+	bool progress(const s_segment&,const s_updecoder& dec) {
+		while ( from < to && dec.have[from] )
+			++from;
+		return from < to;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Upload just the addresses [lo,hi) of seg from a buffer that is
+// already loaded and relocated. Returns the bytes of it received.
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+read_window(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,unsigned lo,unsigned hi) {
+	s_windowwatch watch(lo - seg.offset,hi - seg.offset);
+	s_updecoder dec;
+	unsigned got = 0;
+
+	upload_buffer(u,etype,seg,image,dec,0,&watch,lo - seg.offset);
+	for ( unsigned a = lo; a < hi; ++a )
+		if ( dec.have[a - seg.offset] )
+			++got;
+	return got;
+}
+
+static void
+hex_dump(const unsigned char *data,unsigned addr,unsigned n) {
+
+	for ( unsigned x = 0; x < n; x += 16 ) {
+		unsigned len = n - x < 16 ? n - x : 16;
+
+		printf("%04X: ",addr + x);
+		for ( unsigned y = 0; y < 16; ++y )
+			if ( y < len )
+				printf("%02X ",data[x+y]);
+			else	fputs("   ",stdout);
+		fputs(" |",stdout);
+		for ( unsigned y = 0; y < len; ++y )
+			putchar(data[x+y] >= 0x20 && data[x+y] < 0x7F ? data[x+y] : '.');
+		puts("|");
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read only the addresses [start,start+len): each segment holding
+// part of the window is uploaded from the window start and cut off
+// once the window is in. The window goes to path (a binary file holds
+// just the window, other formats keep the chip addresses), or is hex
+// dumped to stdout when path is null.
+//////////////////////////////////////////////////////////////////////
+
+void
+download_range(s_unit& u,const s_eprom_type& etype,unsigned start,unsigned len,const char *path,e_imgfmt fmt) {
+	const char *phase = perf_phase("write");
+	unsigned size = image_size(etype), end = start + len, got = 0;
+	std::vector<unsigned char> image(size,0xFF);
+	std::string text;
+	s_updecoder dec;
+
+	if ( len == 0 || start >= size || len > size - start ) {
+		fprintf(stderr,"Range 0x%04X:0x%X is outside the %u byte %s\n",
+			start,
+			len,
+			size,
+			etype.name.c_str());
+		exit(1);
+	}
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		unsigned lo = start > it->offset ? start : it->offset;
+		unsigned hi = end < it->offset + etype.segsize ? end : it->offset + etype.segsize;
+
+		if ( lo >= hi )
+			continue;
+
+		s_windowwatch watch(lo - it->offset,hi - it->offset);
+
+		if ( verbose )
+			printf("Reading 0x%04X-0x%04X from segment %s\n",lo,hi - 1,it->title.c_str());
+		upload_segment(u,etype,*it,image.data(),dec,&text,&watch,lo - it->offset);
+
+		for ( unsigned a = lo; a < hi; ++a )
+			if ( dec.have[a - it->offset] )
+				++got;
+	}
+
+	if ( !verbose )
+		putchar('\n');
+	if ( got < len )
+		fprintf(stderr,"WARNING: received %u of the %u bytes in range 0x%04X:0x%X\n",
+			got,
+			len,
+			start,
+			len);
+
+	if ( !path ) {
+		hex_dump(image.data() + start,start,len);
+		perf_phase(phase);
+		return;
+	}
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+
+	s_output out;
+
+	open_output(out,path,fmt,fmt == FMT_BIN ? len : size,stdout);
+	out.writer->segment(fmt == FMT_BIN ? 0 : start,image.data() + start,len,text);
+	close_output(out);
+
+	s_imgdigest digest;
+
+	digest.advance(image.data() + start,len);
+	write_digests(path,digest,len,stdout);
+	perf_phase(phase);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Unpack a .ppz image of this EPROM type into another image format
+//////////////////////////////////////////////////////////////////////
+
+static void
+convert_ppz(const char *dump,const s_eprom_type& etype,const char *path,e_imgfmt fmt) {
+	std::vector<unsigned char> image(image_size(etype));
+	s_ppzfile ppz;
+	const char *why = ppz.open(dump);
+
+	if ( why ) {
+		fprintf(stderr,"%s: Opening %s for read.\n",why,dump);
+		exit(2);
+	}
+	if ( ppz.size != image.size() ) {
+		fprintf(stderr,"%s: image is %u bytes, the %s is %u\n",
+			dump,
+			ppz.size,
+			etype.name.c_str(),
+			unsigned(image.size()));
+		exit(1);
+	}
+	if ( !ppz.read(0,image.size(),image.data()) ) {
+		fprintf(stderr,"%s: damaged segment\n",dump);
+		exit(2);
+	}
+	if ( !write_image(etype,image.data(),path,fmt) ) {
+		fputs("The text format needs the raw upload: use -f bin, ihex, srec or ppz\n",stderr);
+		exit(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Convert an archived upload text dump (the text format written by
+// -d) for this EPROM type into another image format. A .ppz dump is
+// unpacked instead.
+//////////////////////////////////////////////////////////////////////
+
+void
+convert_dump(const char *dump,const s_eprom_type& etype,const char *path,e_imgfmt fmt) {
+	FILE *dfile;
+	std::string text;
+	char buf[65536];
+	size_t n;
+
+	if ( imgfmt_from_path(dump) == FMT_PPZ ) {
+		convert_ppz(dump,etype,path,fmt);
+		return;
+	}
+
+	dfile = fopen(dump,"r");
+	if ( !dfile ) {
+		fprintf(stderr,"%s: Opening dump %s for read.\n",
+			strerror(errno),
+			dump);
+		exit(2);
+	}
+
+	while ( (n = fread(buf,1,sizeof buf,dfile)) > 0 )
+		text.append(buf,n);
+	fclose(dfile);
+
+	std::vector<unsigned char> image(image_size(etype),0xFF);
+	s_output out;
+	s_updecoder dec;
+	size_t pos = 0;
+	int rc = 0;
+
+	open_output(out,path,fmt,image.size(),stdout);
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		size_t start = pos;
+
+		dec.begin(image.data() + it->offset,it->offset,etype.segsize);
+		pos += dec.feed(text.data() + pos,text.size() - pos);
+
+		if ( !dec.complete() ) {
+			fprintf(stderr,"%s: segment %s decoded %u of %u bytes with %u errors\n",
+				dump,
+				it->ppname.c_str(),
+				dec.filled,
+				dec.size,
+				dec.errors());
+			rc = 1;
+		}
+
+		out.writer->segment(it->offset,image.data() + it->offset,etype.segsize,text.substr(start,pos - start));
+	}
+
+	close_output(out);
+
+	s_imgdigest digest;
+
+	digest.advance(image.data(),image.size());
+	write_digests(path,digest,image.size(),stdout);
+
+	if ( rc )
+		exit(rc);
+}
+
+// End download.cpp
@@ -0,0 +1,227 @@
+///////////////////////////////////////////////////////////////////////
+// fingerprint.cpp -- Quick chip identification from sampled windows
+//
+// Each sampled segment costs one L (load) and then one short U per
+// window, cut off as soon as the window is in, so a fingerprint reads
+// a few percent of the part.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fingerprint.hpp"
+#include "perfmon.hpp"
+#include "digest.hpp"
+
+#include <algorithm>
+
+static unsigned
+mix32(unsigned x) {
+
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static bool
+by_offset(const s_segment *a,const s_segment *b) {
+	return a->offset < b->offset;
+}
+
+static bool
+by_addr(const s_fpwindow& a,const s_fpwindow& b) {
+	return a.addr < b.addr;
+}
+
+void
+fp_plan(const s_eprom_type& etype,unsigned nwin,unsigned wsize,unsigned salt,std::vector<s_fpwindow>& plan) {
+	std::vector<const s_segment *> segs;
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it )
+		segs.push_back(&*it);
+	std::sort(segs.begin(),segs.end(),by_offset);
+
+	unsigned long total = (unsigned long)segs.size() * etype.segsize;
+
+	plan.clear();
+	if ( wsize > etype.segsize )
+		wsize = etype.segsize;
+	if ( wsize == 0 || total == 0 )
+		return;
+	if ( (unsigned long)nwin * wsize > total )
+		nwin = total / wsize;
+
+	for ( unsigned x = 0; x < nwin; ++x ) {
+		unsigned long lo = total * x / nwin, hi = total * (x + 1) / nwin;
+		unsigned long span = hi - lo > wsize ? hi - lo - wsize : 0;
+		unsigned long pos = lo + ((mix32(x * 0x9E3779B9u ^ salt) % (span + 1)) & ~15ul);
+		unsigned off = pos % etype.segsize;
+		s_fpwindow w;
+
+		if ( off + wsize > etype.segsize )
+			off = etype.segsize - wsize;	// Keep within the segment
+		w.addr = segs[pos / etype.segsize]->offset + off;
+		w.len = wsize;
+		plan.push_back(w);
+	}
+	std::sort(plan.begin(),plan.end(),by_addr);
+}
+
+std::string
+fp_hash(const std::vector<s_fpwindow>& plan,const unsigned char *image) {
+	s_sha256 sha;
+	unsigned char d[32];
+
+	for ( auto it = plan.begin(); it != plan.end(); ++it ) {
+		unsigned char hdr[6] = {
+			(unsigned char)(it->addr >> 24), (unsigned char)(it->addr >> 16),
+			(unsigned char)(it->addr >> 8), (unsigned char)it->addr,
+			(unsigned char)(it->len >> 8), (unsigned char)it->len
+		};
+
+		sha.update(hdr,sizeof hdr);
+		sha.update(image + it->addr,it->len);
+	}
+	sha.final(d);
+	return hex_string(d,16);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read the plan's windows into image. Returns false if any window
+// came back short, or a unit stopped answering before it was read.
+//////////////////////////////////////////////////////////////////////
+
+bool
+fp_read(s_unit& u,const s_eprom_type& etype,const std::vector<s_fpwindow>& plan,unsigned char *image) {
+	bool ok = true;
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		bool loaded = false;
+
+		for ( auto wt = plan.begin(); wt != plan.end(); ++wt ) {
+			if ( wt->addr < it->offset || wt->addr >= it->offset + etype.segsize )
+				continue;
+			if ( !loaded ) {
+				if ( !select_type(u,*it) || !load(u) || !relocate(u,it->base) )
+					return false;	// Owned unit lost: the buffer is stale
+				loaded = true;
+			}
+			if ( read_window(u,etype,*it,image,wt->addr,wt->addr + wt->len) < wt->len ) {
+				fprintf(stderr,"WARNING: sample window 0x%04X came back short\n",wt->addr);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fingerprint a reference image file (it must be the part's size)
+//////////////////////////////////////////////////////////////////////
+
+static bool
+fp_file(const char *path,size_t size,const std::vector<s_fpwindow>& plan,std::string& fp) {
+	struct stat st;
+	void *map;
+	int fd = open(path,O_RDONLY);
+
+	if ( fd == -1 )
+		return false;
+	if ( fstat(fd,&st) == -1 || !S_ISREG(st.st_mode) || size_t(st.st_size) != size ) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(0,size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if ( map == MAP_FAILED )
+		return false;
+
+	fp = fp_hash(plan,(const unsigned char *)map);
+	munmap(map,size);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fingerprint the chip and look it up among the images in known (a
+// directory of binary images, when not null). Returns the exit
+// status: 0 identified (or no lookup), 1 unknown, 3 read failed.
+//////////////////////////////////////////////////////////////////////
+
+int
+fingerprint_chip(s_unit& u,const s_eprom_type& etype,unsigned nwin,unsigned wsize,const char *known) {
+	const char *phase = perf_phase("fingerprint");
+	size_t size = image_size(etype);
+	std::vector<unsigned char> image(size,0xFF);
+	std::vector<s_fpwindow> plan;
+	unsigned nbytes = 0;
+
+	fp_plan(etype,nwin,wsize,0,plan);
+	for ( auto it = plan.begin(); it != plan.end(); ++it ) {
+		nbytes += it->len;
+		if ( verbose )
+			printf("Sample window 0x%04X-0x%04X\n",it->addr,it->addr + it->len - 1);
+	}
+
+	bool ok = fp_read(u,etype,plan,image.data());
+
+	perf_phase(phase);
+	if ( !ok ) {
+		fputs("\nFingerprint read failed\n",stderr);
+		return 3;
+	}
+
+	std::string fp = fp_hash(plan,image.data());
+
+	printf("\nFingerprint: %s (%u windows, %u of %lu bytes)\n",
+		fp.c_str(),
+		unsigned(plan.size()),
+		nbytes,
+		(unsigned long)size);
+
+	if ( !known )
+		return 0;
+
+	DIR *dir = opendir(known);
+	std::vector<std::string> matches;
+	struct dirent *ent;
+
+	if ( !dir ) {
+		fprintf(stderr,"%s: Opening known image directory %s\n",
+			strerror(errno),
+			known);
+		exit(2);
+	}
+
+	while ( (ent = readdir(dir)) != 0 ) {
+		std::string path = std::string(known) + "/" + ent->d_name;
+		std::string kfp;
+
+		if ( ent->d_name[0] != '.' && fp_file(path.c_str(),size,plan,kfp) && kfp == fp )
+			matches.push_back(ent->d_name);
+	}
+	closedir(dir);
+
+	if ( matches.empty() ) {
+		printf("No known image in %s matches\n",known);
+		return 1;
+	}
+
+	std::sort(matches.begin(),matches.end());
+	for ( auto it = matches.begin(); it != matches.end(); ++it )
+		printf("Matches %s/%s\n",known,it->c_str());
+	return 0;
+}
+
+// End fingerprint.cpp
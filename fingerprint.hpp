@@ -0,0 +1,32 @@
+///////////////////////////////////////////////////////////////////////
+// fingerprint.hpp -- Sampled window fingerprints of EPROM images
+///////////////////////////////////////////////////////////////////////
+
+#ifndef FINGERPRINT_HPP
+#define FINGERPRINT_HPP
+
+#include <string>
+#include <vector>
+
+#include "prompro.hpp"
+
+struct s_fpwindow {
+	unsigned	addr;		// Image address
+	unsigned	len;
+};
+
+//////////////////////////////////////////////////////////////////////
+// The bytes held by the type's segments are split into nwin equal
+// strata, and one window of wsize bytes is placed in each at a
+// position fixed by (stratum, salt). The same plan is computed for the
+// chip and for a reference file, so their fingerprints compare. A
+// different salt gives an independent set of windows.
+//////////////////////////////////////////////////////////////////////
+
+void fp_plan(const s_eprom_type& etype,unsigned nwin,unsigned wsize,unsigned salt,std::vector<s_fpwindow>& plan);
+std::string fp_hash(const std::vector<s_fpwindow>& plan,const unsigned char *image);
+bool fp_read(s_unit& u,const s_eprom_type& etype,const std::vector<s_fpwindow>& plan,unsigned char *image);
+
+#endif // FINGERPRINT_HPP
+
+// End fingerprint.hpp
@@ -0,0 +1,258 @@
+///////////////////////////////////////////////////////////////////////
+// fpcache.cpp -- Fingerprint cache of previously downloaded images
+//
+// A cache directory holds each clean full download as <sha256>.bin,
+// and an index of lines:
+//
+//	<fingerprint> <eprom type> <N>x<W> <size> <sha256>
+//
+// Before a full read, the chip's fingerprint is read and looked up.
+// On a hit, confirm more windows (at positions that change from run
+// to run) are read and compared with the cached image; only when all
+// agree is the cached image written instead of uploading the chip.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fingerprint.hpp"
+#include "perfmon.hpp"
+#include "digest.hpp"
+
+struct s_cachent {
+	std::string	fp;
+	std::string	etype;
+	std::string	plan;		// "NxW"
+	unsigned long	size;
+	std::string	sha256;
+};
+
+static std::string
+plan_name(unsigned nwin,unsigned wsize) {
+	char buf[32];
+
+	snprintf(buf,sizeof buf,"%ux%u",nwin,wsize);
+	return buf;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Index entries for this type, plan and size
+//////////////////////////////////////////////////////////////////////
+
+static void
+load_index(const char *cache,const s_eprom_type& etype,const std::string& plan,unsigned long size,std::vector<s_cachent>& ents) {
+	std::string path = std::string(cache) + "/index";
+	FILE *f = fopen(path.c_str(),"r");
+	char line[512];
+
+	ents.clear();
+	if ( !f )
+		return;
+
+	while ( fgets(line,sizeof line,f) ) {
+		char fp[65], et[128], pl[32], sha[65];
+		s_cachent ent;
+
+		if ( sscanf(line,"%64s %127s %31s %lu %64s",fp,et,pl,&ent.size,sha) != 5 )
+			continue;
+		if ( etype.name != et || plan != pl || ent.size != size )
+			continue;
+		ent.fp = fp;
+		ent.etype = et;
+		ent.plan = pl;
+		ent.sha256 = sha;
+		ents.push_back(ent);
+	}
+	fclose(f);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read a cached image, checking it against its name
+//////////////////////////////////////////////////////////////////////
+
+static bool
+load_image(const char *cache,const s_cachent& ent,std::vector<unsigned char>& image) {
+	std::string path = std::string(cache) + "/" + ent.sha256 + ".bin";
+	FILE *f = fopen(path.c_str(),"r");
+	s_sha256 sha;
+	unsigned char d[32];
+
+	if ( !f )
+		return false;
+	image.assign(ent.size,0);
+	size_t n = fread(image.data(),1,image.size(),f);
+	fclose(f);
+
+	sha.update(image.data(),n);
+	sha.final(d);
+	if ( n != ent.size || hex_string(d,32) != ent.sha256 ) {
+		fprintf(stderr,"WARNING: cached image %s is damaged: ignored\n",path.c_str());
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Serve a download from the cache if the chip in the socket is one
+// seen before. Returns false (nothing written) when a full read is
+// needed.
+//////////////////////////////////////////////////////////////////////
+
+bool
+cache_download(s_unit& u,const s_eprom_type& etype,const char *cache,unsigned nwin,unsigned wsize,unsigned confirm,const char *path,e_imgfmt fmt) {
+	unsigned long size = image_size(etype);
+	std::string plan_id = plan_name(nwin,wsize);
+	std::vector<s_cachent> ents;
+
+	load_index(cache,etype,plan_id,size,ents);
+	if ( ents.empty() )
+		return false;			// Nothing to match: don't sample
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+	if ( fmt == FMT_TEXT ) {
+		if ( verbose )
+			puts("Cache not used: text output needs the raw upload");
+		return false;
+	}
+
+	const char *phase = perf_phase("cache");
+	std::vector<unsigned char> chip(size,0xFF);
+	std::vector<s_fpwindow> plan, check;
+
+	fp_plan(etype,nwin,wsize,0,plan);
+	if ( !fp_read(u,etype,plan,chip.data()) ) {
+		perf_phase(phase);
+		return false;
+	}
+
+	std::string fp = fp_hash(plan,chip.data());
+	std::vector<const s_cachent *> hits;
+
+	for ( auto it = ents.begin(); it != ents.end(); ++it )
+		if ( it->fp == fp )
+			hits.push_back(&*it);
+
+	if ( verbose )
+		printf("\nFingerprint %s: %u cached image(s)\n",fp.c_str(),unsigned(hits.size()));
+	if ( hits.empty() ) {
+		perf_phase(phase);
+		return false;
+	}
+
+	// Confirm with windows that differ from run to run
+
+	if ( confirm > 0 ) {
+		fp_plan(etype,confirm,wsize,unsigned(time(0)) ^ unsigned(getpid()) << 16,check);
+		if ( !fp_read(u,etype,check,chip.data()) ) {
+			perf_phase(phase);
+			return false;
+		}
+	}
+
+	std::vector<unsigned char> image, found;
+	const s_cachent *match = 0;
+
+	for ( auto ht = hits.begin(); ht != hits.end(); ++ht ) {
+		bool same = load_image(cache,**ht,image);
+
+		for ( auto wt = check.begin(); same && wt != check.end(); ++wt )
+			same = !memcmp(chip.data() + wt->addr,image.data() + wt->addr,wt->len);
+		if ( !same )
+			continue;
+		if ( match ) {
+			if ( verbose )
+				puts("Confirmation windows match more than one cached image");
+			perf_phase(phase);
+			return false;
+		}
+		match = *ht;
+		found.swap(image);
+	}
+
+	perf_phase(phase);
+	if ( !match )
+		return false;
+
+	printf("\nReinserted chip: image %s from the cache (%u + %u windows matched)\n",
+		match->sha256.substr(0,16).c_str(),
+		unsigned(plan.size()),
+		unsigned(check.size()));
+	return write_image(etype,found.data(),path,fmt);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a clean full download to the cache
+//////////////////////////////////////////////////////////////////////
+
+void
+cache_store(const s_eprom_type& etype,const char *cache,unsigned nwin,unsigned wsize,const std::vector<unsigned char>& image) {
+	std::string plan_id = plan_name(nwin,wsize);
+	std::vector<s_fpwindow> plan;
+	std::vector<s_cachent> ents;
+	s_sha256 sha;
+	unsigned char d[32];
+
+	if ( mkdir(cache,0777) == -1 && errno != EEXIST ) {
+		fprintf(stderr,"%s: Creating cache directory %s\n",
+			strerror(errno),
+			cache);
+		return;
+	}
+
+	sha.update(image.data(),image.size());
+	sha.final(d);
+
+	std::string sha256 = hex_string(d,32);
+
+	fp_plan(etype,nwin,wsize,0,plan);
+	std::string fp = fp_hash(plan,image.data());
+
+	load_index(cache,etype,plan_id,image.size(),ents);
+	for ( auto it = ents.begin(); it != ents.end(); ++it )
+		if ( it->sha256 == sha256 )
+			return;				// Already cached
+
+	std::string bin = std::string(cache) + "/" + sha256 + ".bin";
+	std::string tmp = bin + ".tmp";
+	FILE *f = fopen(tmp.c_str(),"w");
+	bool ok;
+
+	ok = f && fwrite(image.data(),1,image.size(),f) == image.size();
+	if ( f )
+		ok = fclose(f) == 0 && ok;	// Closed whether or not the write took
+	if ( !ok || rename(tmp.c_str(),bin.c_str()) == -1 ) {
+		fprintf(stderr,"%s: Writing cache image %s\n",
+			strerror(errno),
+			bin.c_str());
+		unlink(tmp.c_str());
+		return;
+	}
+
+	std::string ipath = std::string(cache) + "/index";
+
+	if ( !(f = fopen(ipath.c_str(),"a")) ) {
+		fprintf(stderr,"%s: Appending to %s\n",
+			strerror(errno),
+			ipath.c_str());
+		return;
+	}
+	fprintf(f,"%s %s %s %lu %s\n",
+		fp.c_str(),
+		etype.name.c_str(),
+		plan_id.c_str(),
+		(unsigned long)image.size(),
+		sha256.c_str());
+	fclose(f);
+
+	if ( verbose )
+		printf("Cached image %s (fingerprint %s)\n",sha256.substr(0,16).c_str(),fp.c_str());
+}
+
+// End fpcache.cpp
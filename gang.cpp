@@ -0,0 +1,336 @@
+///////////////////////////////////////////////////////////////////////
+// gang.cpp -- Reading a batch of chips on several units at once
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gang.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Split the batch between the units: it is scheduled as a whole (so
+// chips of a type are together), then each unit gets the next run of
+// it, scheduled again from the type the unit has selected.
+//////////////////////////////////////////////////////////////////////
+
+void
+s_gang::deal(std::vector<s_chipjob>& jobs,const std::vector<s_unit*>& units) {
+	size_t nu = units.size(), from = 0;
+
+	schedule(jobs,"");
+	workers.resize(nu);
+	for ( size_t w = 0; w < nu; ++w ) {
+		size_t to = jobs.size() * (w + 1) / nu;
+		std::vector<s_chipjob> run(jobs.begin() + from,jobs.begin() + to);
+
+		schedule(run,units[w]->prompro_type);
+		workers[w].unit = units[w];
+		workers[w].jobs.assign(run.begin(),run.end());
+		from = to;
+	}
+}
+
+void
+s_gang::start() {
+
+	t0 = now_secs();
+	running = workers.size();
+	for ( size_t w = 0; w < workers.size(); ++w ) {
+		workers[w].unit->owned = true;
+		workers[w].unit->echo = false;	// Echo of several units is noise
+		workers[w].thread = std::thread(&s_gang::work,this,unsigned(w));
+	}
+}
+
+void
+s_gang::join() {
+
+	for ( auto it = workers.begin(); it != workers.end(); ++it ) {
+		if ( it->thread.joinable() )
+			it->thread.join();
+		it->unit->owned = false;
+		it->unit->echo = true;
+	}
+	t1 = now_secs();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Next chip for worker w: from its own queue, else stolen from the
+// back of the longest other queue. Returns false when no chips are
+// left (and none can come back from a lost unit), or the operator
+// stopped the batch.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_gang::take(unsigned w,s_chipjob& job,bool& stolen) {
+	std::unique_lock<std::mutex> lock(mx);
+	std::deque<s_chipjob>& own = workers[w].jobs;
+
+	for (;;) {
+		size_t victim = w;
+
+		if ( stopping )
+			return false;
+
+		if ( !own.empty() ) {
+			job = own.front();
+			own.pop_front();
+			stolen = false;
+			++holding;
+			return true;
+		}
+
+		for ( size_t v = 0; v < workers.size(); ++v )
+			if ( workers[v].jobs.size() > (victim == w ? 0 : workers[victim].jobs.size()) )
+				victim = v;
+		if ( victim != w ) {
+			job = workers[victim].jobs.back();
+			workers[victim].jobs.pop_back();
+			stolen = true;
+			++holding;
+			return true;
+		}
+
+		if ( holding == 0 )
+			return false;
+		cv.wait(lock);			// A lost unit may hand one back
+	}
+}
+
+void
+s_gang::done() {
+	std::lock_guard<std::mutex> lock(mx);
+
+	--holding;
+	cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Worker w's unit stopped answering with job taken: put it back for
+// the other units
+//////////////////////////////////////////////////////////////////////
+
+void
+s_gang::lose(unsigned w,const s_chipjob& job) {
+	std::lock_guard<std::mutex> lock(mx);
+
+	workers[w].lost = true;
+	workers[w].jobs.push_front(job);
+	--holding;
+	printf("Unit %s stopped answering: chip %u (%s) goes back in the queue\n",
+		workers[w].unit->name.c_str(),
+		job.n,
+		job.etype->name.c_str());
+	fflush(stdout);
+	cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Worker side: ask for workers[w].cur to be put in the socket, and
+// wait for the answer. Returns false if the batch was stopped.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_gang::ask(unsigned w) {
+	std::unique_lock<std::mutex> lock(mx);
+	s_ganger& g = workers[w];
+
+	if ( stopping )
+		return false;
+
+	g.answer = 0;
+	asks.push_back(w);
+	cv.notify_all();
+	while ( g.answer == 0 )
+		cv.wait(lock);
+	return g.answer > 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Main thread side: wait for the oldest ask (the chip wanted is in
+// job). Returns false once every worker has finished.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_gang::next_ask(unsigned& w,s_chipjob& job) {
+	std::unique_lock<std::mutex> lock(mx);
+
+	while ( asks.empty() && running > 0 )
+		cv.wait(lock);
+	if ( asks.empty() )
+		return false;
+
+	w = asks.front();
+	job = workers[w].cur;
+	return true;
+}
+
+void
+s_gang::answer(unsigned w,bool go) {
+	std::lock_guard<std::mutex> lock(mx);
+
+	for ( auto it = asks.begin(); it != asks.end(); ++it )
+		if ( *it == w ) {
+			asks.erase(it);
+			break;
+		}
+	workers[w].answer = go ? 1 : -1;
+
+	if ( !go ) {
+		stopping = true;
+		for ( auto it = asks.begin(); it != asks.end(); ++it )
+			workers[*it].answer = -1;
+		asks.clear();
+	}
+	cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Worker thread for workers[w]: the selection for each chip starts
+// before the ask, so it completes while the operator gets to it. The
+// output is written here too; its messages are printed in one piece.
+//////////////////////////////////////////////////////////////////////
+
+void
+s_gang::work(unsigned w) {
+	s_ganger& g = workers[w];
+	s_unit& u = *g.unit;
+	s_chipjob job;
+	bool stolen;
+
+	while ( take(w,job,stolen) ) {
+		if ( stolen ) {
+			std::vector<s_chipjob> one(1,job);
+
+			schedule(one,u.prompro_type);	// Reorder for this unit
+			job = one[0];
+		}
+
+		if ( !select_type_start(u,*job.etype,job.order[0]) ) {
+			lose(w,job);
+			break;
+		}
+		g.cur = job;
+
+		double t = now_secs();
+
+		if ( !ask(w) ) {
+			done();
+			break;
+		}
+
+		double t2 = now_secs();
+		s_chipimage chip;
+		bool clean = read_chip(u,*job.etype,job.path.c_str(),job.fmt,&job.order,chip);
+		double t3 = now_secs();
+
+		if ( !u.healthy ) {
+			lose(w,job);		// Still in this unit's socket
+			break;
+		}
+		char *report = 0;
+		size_t rlen = 0;
+		FILE *msg = open_memstream(&report,&rlen);
+
+		if ( !msg ) {
+			fprintf(stderr,"%s: open_memstream()\n",strerror(errno));
+			exit(3);
+		}
+		fprintf(msg,"Unit %s: chip %u (%s) read%s in %.1f secs\n",
+			u.name.c_str(),
+			job.n,
+			job.etype->name.c_str(),
+			clean ? "" : " with errors",
+			t3 - t2);
+		save_chip(*job.etype,chip,job.path.c_str(),job.fmt,msg);
+		fclose(msg);
+
+		g.waiting += t2 - t;
+		g.reading += t3 - t2;
+		g.chips++;
+		g.stolen += stolen;
+		g.failed += !clean;
+		g.bytes += chip.image.size();
+
+		std::lock_guard<std::mutex> lock(mx);
+
+		fputs(report,stdout);
+		fflush(stdout);
+		free(report);
+		--holding;
+		cv.notify_all();
+	}
+
+	if ( u.healthy )
+		command_finish(u);
+
+	std::lock_guard<std::mutex> lock(mx);
+
+	--running;
+	cv.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Combined report: what each unit did, and how close the gang came
+// to running its units flat out in parallel (reading seconds summed
+// over the units, against the wall time of the run).
+//////////////////////////////////////////////////////////////////////
+
+void
+s_gang::report(unsigned listed) const {
+	unsigned chips = 0, stolen = 0, failed = 0;
+	unsigned long bytes = 0;
+	double reading = 0.0, wall = t1 - t0;
+
+	printf("\n%-12s %5s %6s %6s %8s %5s %9s %9s %9s\n",
+		"Unit","Chips","Stolen","Failed","Switches","Loads","Read s","Wait s","Bytes/s");
+
+	for ( auto it = workers.begin(); it != workers.end(); ++it ) {
+		const s_unit& u = *it->unit;
+		auto s = u.wirestats.find("S"), l = u.wirestats.find("L");
+
+		printf("%-12s %5u %6u %6u %8lu %5lu %9.1f %9.1f %9.1f%s\n",
+			u.name.c_str(),
+			it->chips,
+			it->stolen,
+			it->failed,
+			s != u.wirestats.end() ? s->second.count : 0ul,
+			l != u.wirestats.end() ? l->second.count : 0ul,
+			it->reading,
+			it->waiting,
+			it->reading > 0.0 ? it->bytes / it->reading : 0.0,
+			it->lost ? "  (lost)" : "");
+
+		chips += it->chips;
+		stolen += it->stolen;
+		failed += it->failed;
+		bytes += it->bytes;
+		reading += it->reading;
+	}
+
+	printf("%-12s %5u %6u %6u %8s %5s %9.1f %9s %9.1f\n",
+		"Total",
+		chips,
+		stolen,
+		failed,
+		"",
+		"",
+		reading,
+		"",
+		wall > 0.0 ? bytes / wall : 0.0);
+
+	printf("\nGang done: %u of %u chips on %u units in %.1f secs",
+		chips,
+		listed,
+		unsigned(workers.size()),
+		wall);
+	if ( wall > 0.0 && reading > 0.0 )
+		printf(": %.2fx one unit (%.0f%% of linear)",
+			reading / wall,
+			100.0 * reading / wall / workers.size());
+	putchar('\n');
+}
+
+// End gang.cpp
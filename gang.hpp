@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////
+// gang.hpp -- Reading a batch of chips on several units at once
+///////////////////////////////////////////////////////////////////////
+
+#ifndef GANG_HPP
+#define GANG_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "prompro.hpp"
+#include "sched.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Each unit gets a worker thread and its own queue of chips, a run of
+// the batch scheduled for it. A worker takes its chips from the front
+// of its queue; one that runs dry steals from the back of the longest
+// other queue (the chips its owner would reach last), and reorders the
+// stolen chip's segments for the type it has selected.
+//
+// Workers never talk to the operator. A worker that wants its next
+// chip in the socket asks, and waits for the main thread to answer:
+// the main thread puts the asks to the operator one at a time, in the
+// order they came, while the other units keep reading.
+//
+// A unit that stops answering is lost: its worker puts the chip it
+// had back on its queue, for the others to steal, and stops. So that
+// such a chip is never stranded, a worker with nothing to take waits
+// while any other worker still holds one.
+//////////////////////////////////////////////////////////////////////
+
+struct s_ganger {
+	s_unit		*unit;
+	std::deque<s_chipjob> jobs;	// Own queue
+	std::thread	thread;
+	unsigned	chips;		// Chips read
+	unsigned	stolen;		// Of those, taken from other queues
+	unsigned	failed;		// Chips that did not read clean
+	unsigned long	bytes;		// Image bytes read
+	double		reading;	// Seconds reading chips
+	double		waiting;	// Seconds waiting for the operator
+	s_chipjob	cur;		// Chip asked for, or being read
+	int		answer;		// To its ask: 0 pending, 1 go, -1 stop
+	bool		lost;		// Unit stopped answering
+
+	s_ganger() : unit(0), chips(0), stolen(0), failed(0), bytes(0),
+		reading(0.0), waiting(0.0), answer(0), lost(false) {}
+};
+
+struct s_gang {
+	std::vector<s_ganger>	workers;
+	double			t0, t1;		// Wall time of the run
+
+	s_gang() : t0(0.0), t1(0.0), running(0), holding(0), stopping(false) {}
+
+	void deal(std::vector<s_chipjob>& jobs,const std::vector<s_unit*>& units);
+	void start();
+	bool next_ask(unsigned& w,s_chipjob& job); // False once all are done
+	void answer(unsigned w,bool go);	// go false stops the batch
+	void join();
+	void report(unsigned listed) const;
+
+private:
+	std::mutex		mx;
+	std::condition_variable	cv;
+	std::deque<unsigned>	asks;		// Workers waiting for a chip
+	unsigned		running;	// Workers not yet finished
+	unsigned		holding;	// Workers with a chip taken
+	bool			stopping;	// Operator stopped the batch
+
+	bool take(unsigned w,s_chipjob& job,bool& stolen);
+	void done();
+	void lose(unsigned w,const s_chipjob& job);
+	bool ask(unsigned w);
+	void work(unsigned w);
+};
+
+#endif // GANG_HPP
+
+// End gang.hpp
@@ -0,0 +1,234 @@
+///////////////////////////////////////////////////////////////////////
+// hexcodec.cpp -- ASCII hex <-> binary conversion kernels
+//
+// The vector kernels classify each character as a digit or a letter
+// with signed byte compares (bytes >= 0x80 compare negative, so they
+// fail both tests), form the nibble values, then merge adjacent nibble
+// pairs within 16-bit lanes and pack the lanes down to bytes.
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
+
+#include "hexcodec.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Scalar kernel: 0..15 for hex digits, 0xFF otherwise
+//////////////////////////////////////////////////////////////////////
+
+static unsigned char nibble[256];
+
+static bool
+init_nibble() {
+
+	memset(nibble,0xFF,sizeof nibble);
+	for ( int x = 0; x < 10; ++x )
+		nibble['0' + x] = x;
+	for ( int x = 0; x < 6; ++x )
+		nibble['A' + x] = nibble['a' + x] = 10 + x;
+	return true;
+}
+
+static bool nibble_ready = init_nibble();
+
+//////////////////////////////////////////////////////////////////////
+// Encoding: one table lookup yields both digits of a byte
+//////////////////////////////////////////////////////////////////////
+
+static char hexpairs[256][2];
+
+static bool
+init_hexpairs() {
+	static const char digits[] = "0123456789ABCDEF";
+
+	for ( int x = 0; x < 256; ++x ) {
+		hexpairs[x][0] = digits[x >> 4];
+		hexpairs[x][1] = digits[x & 0x0F];
+	}
+	return true;
+}
+
+static bool hexpairs_ready = init_hexpairs();
+
+unsigned
+hex_encode(const unsigned char *src,size_t n,char *dst) {
+	unsigned sum = 0;
+
+	(void)hexpairs_ready;
+	for ( size_t x = 0; x < n; ++x ) {
+		memcpy(dst,hexpairs[src[x]],2);
+		dst += 2;
+		sum += src[x];
+	}
+	return sum;
+}
+
+static bool
+decode_scalar(const char *src,size_t nchars,unsigned char *dst) {
+	const unsigned char *s = (const unsigned char *)src;
+	unsigned bad = 0;
+
+	if ( nchars & 1 )
+		return false;
+
+	for ( size_t x = 0; x < nchars; x += 2 ) {
+		unsigned hi = nibble[s[x]], lo = nibble[s[x+1]];
+
+		bad |= hi | lo;
+		*dst++ = (unsigned char)(hi << 4 | lo);
+	}
+	return (bad & 0xF0) == 0;
+}
+
+#ifdef HEX_X86
+
+//////////////////////////////////////////////////////////////////////
+// SSE2: 32 characters -> 16 bytes per iteration
+//////////////////////////////////////////////////////////////////////
+
+static inline __m128i
+nibbles_sse2(__m128i c,__m128i& valid) {
+	const __m128i lc = _mm_or_si128(c,_mm_set1_epi8(0x20));
+	const __m128i dig = _mm_and_si128(
+		_mm_cmpgt_epi8(c,_mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(c,_mm_set1_epi8('9' + 1)));
+	const __m128i alpha = _mm_and_si128(
+		_mm_cmpgt_epi8(lc,_mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lc,_mm_set1_epi8('f' + 1)));
+
+	valid = _mm_and_si128(valid,_mm_or_si128(dig,alpha));
+	return _mm_or_si128(
+		_mm_and_si128(dig,_mm_sub_epi8(c,_mm_set1_epi8('0'))),
+		_mm_and_si128(alpha,_mm_sub_epi8(lc,_mm_set1_epi8('a' - 10))));
+}
+
+static inline __m128i
+pairs_sse2(__m128i n) {
+	// Lane = hi nibble in low byte, lo nibble in high byte
+	return _mm_or_si128(
+		_mm_slli_epi16(_mm_and_si128(n,_mm_set1_epi16(0x00FF)),4),
+		_mm_srli_epi16(n,8));
+}
+
+static bool
+decode_sse2(const char *src,size_t nchars,unsigned char *dst) {
+	__m128i valid = _mm_set1_epi8(-1);
+	size_t x = 0;
+
+	if ( nchars & 1 )
+		return false;
+
+	for ( ; x + 32 <= nchars; x += 32 ) {
+		__m128i a = nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + x)),valid);
+		__m128i b = nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + x + 16)),valid);
+
+		_mm_storeu_si128((__m128i *)(dst + x / 2),_mm_packus_epi16(pairs_sse2(a),pairs_sse2(b)));
+	}
+
+	if ( _mm_movemask_epi8(valid) != 0xFFFF )
+		return false;
+	return decode_scalar(src + x,nchars - x,dst + x / 2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// AVX2: 64 characters -> 32 bytes per iteration
+//////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static inline __m256i
+nibbles_avx2(__m256i c,__m256i& valid) {
+	const __m256i lc = _mm256_or_si256(c,_mm256_set1_epi8(0x20));
+	const __m256i dig = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(c,_mm256_set1_epi8('9')),
+		_mm256_cmpgt_epi8(c,_mm256_set1_epi8('0' - 1)));
+	const __m256i alpha = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(lc,_mm256_set1_epi8('f')),
+		_mm256_cmpgt_epi8(lc,_mm256_set1_epi8('a' - 1)));
+
+	valid = _mm256_and_si256(valid,_mm256_or_si256(dig,alpha));
+	return _mm256_or_si256(
+		_mm256_and_si256(dig,_mm256_sub_epi8(c,_mm256_set1_epi8('0'))),
+		_mm256_and_si256(alpha,_mm256_sub_epi8(lc,_mm256_set1_epi8('a' - 10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+pairs_avx2(__m256i n) {
+	return _mm256_or_si256(
+		_mm256_slli_epi16(_mm256_and_si256(n,_mm256_set1_epi16(0x00FF)),4),
+		_mm256_srli_epi16(n,8));
+}
+
+__attribute__((target("avx2")))
+static bool
+decode_avx2(const char *src,size_t nchars,unsigned char *dst) {
+	__m256i valid = _mm256_set1_epi8(-1);
+	size_t x = 0;
+
+	if ( nchars & 1 )
+		return false;
+
+	for ( ; x + 64 <= nchars; x += 64 ) {
+		__m256i a = nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + x)),valid);
+		__m256i b = nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + x + 32)),valid);
+		__m256i p = _mm256_packus_epi16(pairs_avx2(a),pairs_avx2(b));
+
+		// packus works per 128-bit lane: restore qword order 0,2,1,3
+		_mm256_storeu_si256((__m256i *)(dst + x / 2),_mm256_permute4x64_epi64(p,0xD8));
+	}
+
+	if ( (unsigned)_mm256_movemask_epi8(valid) != 0xFFFFFFFFu )
+		return false;
+	return decode_sse2(src + x,nchars - x,dst + x / 2);
+}
+
+#endif // HEX_X86
+
+//////////////////////////////////////////////////////////////////////
+// Kernel selection
+//////////////////////////////////////////////////////////////////////
+
+hex_decode_fn
+hex_decode_kernel(const char *name) {
+
+	if ( !strcmp(name,"scalar") )
+		return decode_scalar;
+#ifdef HEX_X86
+	if ( !strcmp(name,"sse2") && __builtin_cpu_supports("sse2") )
+		return decode_sse2;
+	if ( !strcmp(name,"avx2") && __builtin_cpu_supports("avx2") )
+		return decode_avx2;
+#endif
+	return 0;
+}
+
+static const char *
+pick_best() {
+
+	if ( hex_decode_kernel("avx2") )
+		return "avx2";
+	if ( hex_decode_kernel("sse2") )
+		return "sse2";
+	return "scalar";
+}
+
+const char *
+hex_decode_best() {
+	static const char *const best = pick_best();	// Once, thread safe
+
+	return best;
+}
+
+bool
+hex_decode(const char *src,size_t nchars,unsigned char *dst) {
+	static const hex_decode_fn fn = hex_decode_kernel(hex_decode_best());	// Gang workers share it
+
+	(void)nibble_ready;
+	return fn(src,nchars,dst);
+}
+
+// End hexcodec.cpp
@@ -0,0 +1,35 @@
+///////////////////////////////////////////////////////////////////////
+// hexcodec.hpp -- ASCII hex <-> binary conversion kernels
+///////////////////////////////////////////////////////////////////////
+
+#ifndef HEXCODEC_HPP
+#define HEXCODEC_HPP
+
+#include <stddef.h>
+
+//////////////////////////////////////////////////////////////////////
+// Decode nchars hex digits (upper or lower case) into nchars/2 bytes.
+// Returns false if nchars is odd or any character is not a hex digit
+// (dst contents are then unspecified). The best kernel for the CPU
+// (AVX2, SSE2 or scalar) is chosen on first use.
+//////////////////////////////////////////////////////////////////////
+
+bool hex_decode(const char *src,size_t nchars,unsigned char *dst);
+
+//////////////////////////////////////////////////////////////////////
+// Encode n bytes as 2*n upper case hex digits (no terminator). Also
+// returns the byte sum, for record checksums.
+//////////////////////////////////////////////////////////////////////
+
+unsigned hex_encode(const unsigned char *src,size_t n,char *dst);
+
+// Individual kernels, for benchmarking (null when not supported):
+
+typedef bool (*hex_decode_fn)(const char *src,size_t nchars,unsigned char *dst);
+
+hex_decode_fn hex_decode_kernel(const char *name);	// "scalar", "sse2", "avx2"
+const char *hex_decode_best();				// Name of kernel in use
+
+#endif // HEXCODEC_HPP
+
+// End hexcodec.hpp
@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////
+// imgfmt.cpp -- Streaming EPROM image output writers
+//
+// Records are encoded through the hex_encode() pair table, and their
+// checksums accumulate from the byte sums it returns, so each record
+// is formatted once into a small line buffer and written out.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "imgfmt.hpp"
+#include "hexcodec.hpp"
+#include "ppzfile.hpp"
+
+static const unsigned rec_bytes = 16;		// Data bytes per hex record
+
+e_imgfmt
+imgfmt_parse(const char *name) {
+
+	if ( !strcasecmp(name,"text") || !strcasecmp(name,"txt") )
+		return FMT_TEXT;
+	if ( !strcasecmp(name,"bin") || !strcasecmp(name,"binary") )
+		return FMT_BIN;
+	if ( !strcasecmp(name,"ihex") || !strcasecmp(name,"hex") )
+		return FMT_IHEX;
+	if ( !strcasecmp(name,"srec") || !strcasecmp(name,"s19") )
+		return FMT_SREC;
+	if ( !strcasecmp(name,"ppz") )
+		return FMT_PPZ;
+	return FMT_NONE;
+}
+
+e_imgfmt
+imgfmt_from_path(const char *path) {
+	static const struct {
+		const char	*ext;
+		e_imgfmt	fmt;
+	} exts[] = {
+		{ "bin", FMT_BIN }, { "rom", FMT_BIN }, { "img", FMT_BIN },
+		{ "hex", FMT_IHEX }, { "ihx", FMT_IHEX }, { "ihex", FMT_IHEX },
+		{ "s19", FMT_SREC }, { "s28", FMT_SREC }, { "s37", FMT_SREC },
+		{ "srec", FMT_SREC }, { "mot", FMT_SREC }, { "ppz", FMT_PPZ },
+	};
+	const char *dot = strrchr(path,'.');
+
+	if ( dot && !strchr(dot,'/') )
+		for ( unsigned x = 0; x < sizeof exts / sizeof exts[0]; ++x )
+			if ( !strcasecmp(dot + 1,exts[x].ext) )
+				return exts[x].fmt;
+	return FMT_TEXT;
+}
+
+const char *
+imgfmt_name(e_imgfmt fmt) {
+
+	switch ( fmt ) {
+	case FMT_TEXT:	return "text";
+	case FMT_BIN:	return "bin";
+	case FMT_IHEX:	return "ihex";
+	case FMT_SREC:	return "srec";
+	case FMT_PPZ:	return "ppz";
+	default:	return "?";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Raw upload text, one block per segment (the original -d output)
+//////////////////////////////////////////////////////////////////////
+
+struct s_textwriter : s_imgwriter {
+	s_textwriter(FILE *out,unsigned image_size) : s_imgwriter(out,image_size) {}
+
+	void segment(unsigned,const unsigned char *,unsigned,const std::string& text) {
+		fwrite(text.data(),1,text.size(),out);
+		fputc('\n',out);
+		fflush(out);
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Flat binary: bytes land at their offset, gaps are erased (0xFF).
+// The file is allocated at its full size and mapped, and segments are
+// copied straight into the mapping; where it cannot be allocated or
+// mapped, it is written through the stream instead, so that a full
+// disk is a write error rather than a fault in the mapping.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+preallocate(int fd,unsigned size) {
+
+#ifdef __linux__
+	int err = posix_fallocate(fd,0,size);
+
+	if ( err == 0 )
+		return true;
+	if ( err != EOPNOTSUPP && err != EINVAL )
+		return false;			// No space: a sparse map would fault
+#endif
+	return ftruncate(fd,size) == 0;		// Sparse, where not supported
+}
+
+struct s_binwriter : s_imgwriter {
+	unsigned	end;		// Bytes of the file written so far
+	unsigned char	*map;		// The file, if mapped
+
+	s_binwriter(FILE *out,unsigned image_size) : s_imgwriter(out,image_size), end(0), map(0) {
+		int fd = fileno(out);
+
+		if ( image_size > 0 && preallocate(fd,image_size) ) {
+			void *m = mmap(0,image_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+
+			if ( m != MAP_FAILED ) {
+				map = (unsigned char *)m;
+				memset(map,0xFF,image_size);
+			}
+		}
+	}
+
+	~s_binwriter() {
+		if ( map )
+			munmap(map,image_size);
+	}
+
+	void pad(unsigned to) {
+		static const unsigned char ff[256] = {
+#define FF16 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+			FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16,FF16
+#undef FF16
+		};
+
+		fseek(out,end,SEEK_SET);
+		while ( end < to ) {
+			unsigned n = to - end < sizeof ff ? to - end : sizeof ff;
+
+			fwrite(ff,1,n,out);
+			end += n;
+		}
+	}
+
+	void segment(unsigned addr,const unsigned char *data,unsigned n,const std::string&) {
+		if ( map ) {
+			if ( addr < image_size )
+				memcpy(map + addr,data,addr + n <= image_size ? n : image_size - addr);
+			return;
+		}
+		if ( addr > end )
+			pad(addr);
+		fseek(out,addr,SEEK_SET);
+		fwrite(data,1,n,out);
+		if ( addr + n > end )
+			end = addr + n;
+		fflush(out);
+	}
+
+	bool finish() {
+		if ( map )
+			return msync(map,image_size,MS_SYNC) == 0;
+		pad(image_size);
+		return fflush(out) == 0;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Intel HEX: type 00 data, 04 extended linear address, 01 EOF
+//////////////////////////////////////////////////////////////////////
+
+struct s_ihexwriter : s_imgwriter {
+	unsigned	upper;		// Current extended linear address
+
+	s_ihexwriter(FILE *out,unsigned image_size) : s_imgwriter(out,image_size), upper(0) {}
+
+	void record(unsigned type,unsigned addr,const unsigned char *data,unsigned n) {
+		char line[1 + 2 * (4 + 255 + 1) + 1];
+		unsigned char hdr[4], cs;
+		unsigned sum;
+
+		hdr[0] = n;
+		hdr[1] = (addr >> 8) & 0xFF;
+		hdr[2] = addr & 0xFF;
+		hdr[3] = type;
+
+		line[0] = ':';
+		sum = hex_encode(hdr,4,line + 1);
+		sum += hex_encode(data,n,line + 9);
+		cs = (0x100 - (sum & 0xFF)) & 0xFF;
+		hex_encode(&cs,1,line + 9 + 2 * n);
+		line[11 + 2 * n] = '\n';
+		fwrite(line,1,12 + 2 * n,out);
+	}
+
+	void segment(unsigned addr,const unsigned char *data,unsigned n,const std::string&) {
+		for ( unsigned x = 0; x < n; ) {
+			unsigned a = addr + x;
+			unsigned len = n - x < rec_bytes ? n - x : rec_bytes;
+
+			if ( (a >> 16) != upper ) {
+				unsigned char ela[2];
+
+				upper = a >> 16;
+				ela[0] = (upper >> 8) & 0xFF;
+				ela[1] = upper & 0xFF;
+				record(0x04,0,ela,2);
+			}
+			if ( (a & 0xFFFF) + len > 0x10000 )
+				len = 0x10000 - (a & 0xFFFF);	// Don't wrap within a record
+
+			record(0x00,a & 0xFFFF,data + x,len);
+			x += len;
+		}
+		fflush(out);
+	}
+
+	bool finish() {
+		record(0x01,0,0,0);
+		return fflush(out) == 0;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Motorola S-records: S1/S2/S3 chosen by the part size, S0 header,
+// S5/S6 record count and S9/S8/S7 terminator
+//////////////////////////////////////////////////////////////////////
+
+struct s_srecwriter : s_imgwriter {
+	unsigned	alen;		// Address bytes: 2, 3 or 4
+	unsigned long	count;		// Data records written
+
+	s_srecwriter(FILE *out,unsigned image_size) : s_imgwriter(out,image_size), count(0) {
+		static const unsigned char hdr[] = "prompro";
+
+		alen = image_size <= 0x10000 ? 2 : image_size <= 0x1000000 ? 3 : 4;
+		record('0',2,0,hdr,sizeof hdr - 1);
+	}
+
+	void record(char type,unsigned alen,unsigned addr,const unsigned char *data,unsigned n) {
+		char line[2 + 2 * (1 + 4 + 255 + 1) + 1];
+		unsigned char hdr[5], cs;
+		unsigned sum;
+
+		hdr[0] = alen + n + 1;
+		for ( unsigned x = 0; x < alen; ++x )
+			hdr[1+x] = (addr >> (8 * (alen - 1 - x))) & 0xFF;
+
+		line[0] = 'S';
+		line[1] = type;
+		sum = hex_encode(hdr,1 + alen,line + 2);
+		sum += hex_encode(data,n,line + 2 + 2 * (1 + alen));
+		cs = ~sum & 0xFF;
+		hex_encode(&cs,1,line + 2 + 2 * (1 + alen + n));
+		line[4 + 2 * (1 + alen + n)] = '\n';
+		fwrite(line,1,5 + 2 * (1 + alen + n),out);
+	}
+
+	void segment(unsigned addr,const unsigned char *data,unsigned n,const std::string&) {
+		for ( unsigned x = 0; x < n; x += rec_bytes ) {
+			unsigned len = n - x < rec_bytes ? n - x : rec_bytes;
+
+			record('0' + alen - 1,alen,addr + x,data + x,len);
+			++count;
+		}
+		fflush(out);
+	}
+
+	bool finish() {
+		if ( count <= 0xFFFF )
+			record('5',2,count,0,0);
+		else if ( count <= 0xFFFFFF )
+			record('6',3,count,0,0);
+		record('0' + 11 - alen,alen,0,0,0);	// S9, S8 or S7
+		return fflush(out) == 0;
+	}
+};
+
+s_imgwriter *
+imgwriter_new(e_imgfmt fmt,FILE *out,unsigned image_size) {
+
+	switch ( fmt ) {
+	case FMT_TEXT:	return new s_textwriter(out,image_size);
+	case FMT_BIN:	return new s_binwriter(out,image_size);
+	case FMT_IHEX:	return new s_ihexwriter(out,image_size);
+	case FMT_SREC:	return new s_srecwriter(out,image_size);
+	case FMT_PPZ:	return ppz_writer_new(out,image_size);
+	default:	return 0;
+	}
+}
+
+// End imgfmt.cpp
@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////
+// imgfmt.hpp -- Streaming EPROM image output writers
+///////////////////////////////////////////////////////////////////////
+
+#ifndef IMGFMT_HPP
+#define IMGFMT_HPP
+
+#include <stdio.h>
+
+#include <string>
+
+enum e_imgfmt {
+	FMT_NONE = -1,
+	FMT_TEXT = 0,		// Raw PROMPRO upload text (as before)
+	FMT_BIN,		// Flat binary
+	FMT_IHEX,		// Intel HEX
+	FMT_SREC,		// Motorola S-record
+	FMT_PPZ			// Compressed segments (ppzfile.hpp)
+};
+
+e_imgfmt imgfmt_parse(const char *name);	// "text", "bin", "ihex", "srec", "ppz"
+e_imgfmt imgfmt_from_path(const char *path);	// By extension, else FMT_TEXT
+const char *imgfmt_name(e_imgfmt fmt);
+
+//////////////////////////////////////////////////////////////////////
+// A writer is handed each segment as soon as it completes, in any
+// address order, and writes its records straight to the stream (the
+// binary writer maps the file instead, so out must be open for read
+// and write). text is the raw upload of the segment (only the text
+// format uses it). finish() writes any trailer and flushes; it does
+// not close the stream, and returns false if the image did not reach
+// the file.
+//////////////////////////////////////////////////////////////////////
+
+struct s_imgwriter {
+	FILE		*out;
+	unsigned	image_size;	// Size of the whole part
+
+	s_imgwriter(FILE *out,unsigned image_size) : out(out), image_size(image_size) {}
+	virtual ~s_imgwriter() {}
+
+	virtual void segment(unsigned addr,const unsigned char *data,unsigned n,const std::string& text) = 0;
+	virtual bool finish() { return true; }
+};
+
+s_imgwriter *imgwriter_new(e_imgfmt fmt,FILE *out,unsigned image_size);
+
+#endif // IMGFMT_HPP
+
+// End imgfmt.hpp
@@ -0,0 +1,214 @@
+///////////////////////////////////////////////////////////////////////
+// journal.cpp -- Journal of a download in progress, for --resume
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "journal.hpp"
+#include "fingerprint.hpp"
+#include "perfmon.hpp"
+
+static const unsigned check_windows = 16;	// Identity check windows
+static const unsigned check_wsize = 64;
+
+//////////////////////////////////////////////////////////////////////
+// Load the journal for path, if it is for this EPROM type, reading
+// the saved bytes into image. Returns true if anything was saved.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_journal::load(const s_eprom_type& etype,const char *path,unsigned char *image) {
+	FILE *f;
+	char line[512], name[128];
+	unsigned version, segsize, nsegs, size, got = 0;
+
+	jpath = std::string(path) + ".journal";
+	ppath = std::string(path) + ".part";
+	saved.assign(etype.segs.size(),0);
+
+	if ( !(f = fopen(jpath.c_str(),"r")) )
+		return false;
+
+	if ( !fgets(line,sizeof line,f)
+	  || sscanf(line,"prompro-journal %u %127s %u %u %u",&version,name,&segsize,&nsegs,&size) != 5
+	  || version != 1 || etype.name != name || segsize != etype.segsize
+	  || nsegs != etype.segs.size() || size != image_size(etype) ) {
+		fclose(f);
+		fprintf(stderr,"WARNING: %s is not a journal of this %s download: ignored\n",
+			jpath.c_str(),
+			etype.name.c_str());
+		return false;
+	}
+
+	while ( fgets(line,sizeof line,f) ) {
+		unsigned x, offset, n;
+
+		if ( sscanf(line,"%u %u %u",&x,&offset,&n) != 3 )
+			continue;		// Torn by an interruption
+		if ( x >= nsegs || offset != etype.segs[x].offset || n > segsize )
+			continue;
+		saved[x] = n;
+	}
+	fclose(f);
+
+	int pfd = ::open(ppath.c_str(),O_RDONLY);
+
+	for ( unsigned x = 0; x < nsegs; ++x ) {
+		const s_segment& seg = etype.segs[x];
+		ssize_t n = 0;
+
+		if ( saved[x] > 0 && pfd != -1 )
+			n = pread(pfd,image + seg.offset,saved[x],seg.offset);
+		if ( n < ssize_t(saved[x]) )
+			saved[x] = n > 0 ? n : 0;
+		got += saved[x];
+	}
+	if ( pfd != -1 )
+		::close(pfd);
+	return got > 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open the journal for writing: a fresh one, or appending to the one
+// just loaded. A journal that cannot be written only costs --resume.
+//////////////////////////////////////////////////////////////////////
+
+void
+s_journal::start(const s_eprom_type& etype,const char *path,bool append) {
+
+	jpath = std::string(path) + ".journal";
+	ppath = std::string(path) + ".part";
+	if ( !append )
+		saved.assign(etype.segs.size(),0);
+
+	fd = ::open(ppath.c_str(),O_RDWR|O_CREAT|(append ? 0 : O_TRUNC),0666);
+	if ( fd == -1 || !(log = fopen(jpath.c_str(),append ? "a" : "w")) ) {
+		fprintf(stderr,"%s: Creating journal %s (--resume not possible)\n",
+			strerror(errno),
+			fd == -1 ? ppath.c_str() : jpath.c_str());
+		close();
+		return;
+	}
+
+	if ( !append )
+		fprintf(log,"prompro-journal 1 %s %u %u %u\n",
+			etype.name.c_str(),
+			etype.segsize,
+			unsigned(etype.segs.size()),
+			image_size(etype));
+	fflush(log);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record that the leading upto bytes of segment x are in image
+//////////////////////////////////////////////////////////////////////
+
+void
+s_journal::save(unsigned x,const s_segment& seg,const unsigned char *image,unsigned upto) {
+
+	if ( !log || upto <= saved[x] )
+		return;
+
+	const char *phase = perf_phase("journal");
+	unsigned from = saved[x];
+	ssize_t n = pwrite(fd,image + seg.offset + from,upto - from,seg.offset + from);
+
+	if ( n != ssize_t(upto - from) ) {
+		fprintf(stderr,"%s: Writing journal %s (--resume not possible)\n",
+			n == -1 ? strerror(errno) : "Short write",
+			ppath.c_str());
+		close();
+	} else	{
+		fprintf(log,"%u %u %u\n",x,seg.offset,upto);
+		fflush(log);
+		saved[x] = upto;
+	}
+	perf_phase(phase);
+}
+
+void
+s_journal::close() {
+
+	if ( log )
+		fclose(log);
+	if ( fd != -1 )
+		::close(fd);
+	log = 0;
+	fd = -1;
+}
+
+void
+s_journal::remove() {
+
+	close();
+	unlink(ppath.c_str());
+	unlink(jpath.c_str());
+}
+
+void
+journal_discard(const char *path) {
+
+	unlink((std::string(path) + ".part").c_str());
+	unlink((std::string(path) + ".journal").c_str());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Before resuming, make sure the chip in the socket is the one the
+// journal was made from: fingerprint windows that fall in the saved
+// bytes are read from the chip and compared.
+//////////////////////////////////////////////////////////////////////
+
+bool
+journal_matches(s_unit& u,const s_eprom_type& etype,const s_journal& journal,const unsigned char *image) {
+	std::vector<s_fpwindow> plan, check;
+	std::vector<unsigned char> chip(image_size(etype),0xFF);
+
+	fp_plan(etype,check_windows,check_wsize,0,plan);
+	for ( auto wt = plan.begin(); wt != plan.end(); ++wt ) {
+		for ( unsigned x = 0; x < etype.segs.size(); ++x ) {
+			const s_segment& seg = etype.segs[x];
+
+			if ( wt->addr >= seg.offset && wt->addr + wt->len <= seg.offset + journal.saved[x] ) {
+				check.push_back(*wt);
+				break;
+			}
+		}
+	}
+
+	if ( check.empty() ) {
+		// Too little saved for the plan: check the first saved bytes
+
+		for ( unsigned x = 0; x < etype.segs.size() && check.empty(); ++x ) {
+			if ( journal.saved[x] > 0 ) {
+				s_fpwindow w;
+
+				w.addr = etype.segs[x].offset;
+				w.len = journal.saved[x] < check_wsize ? journal.saved[x] : check_wsize;
+				check.push_back(w);
+			}
+		}
+	}
+
+	const char *phase = perf_phase("fingerprint");
+	bool ok = fp_read(u,etype,check,chip.data());
+
+	perf_phase(phase);
+	if ( !ok )
+		return false;
+
+	std::string want = fp_hash(check,image), got = fp_hash(check,chip.data());
+
+	if ( verbose )
+		printf("\nJournal fingerprint %s, chip %s (%u windows)\n",
+			want.c_str(),
+			got.c_str(),
+			unsigned(check.size()));
+	return want == got;
+}
+
+// End journal.cpp
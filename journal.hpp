@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////
+// journal.hpp -- Journal of a download in progress, for --resume
+///////////////////////////////////////////////////////////////////////
+
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "prompro.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Next to the output file, <path>.part holds the image bytes received
+// so far (at their chip addresses) and <path>.journal is an append
+// only log of how much of each segment is in it:
+//
+//	prompro-journal 1 <eprom type> <segsize> <segments> <image size>
+//	<segment index> <offset> <leading bytes saved>
+//	...
+//
+// The last line for a segment wins. Bytes are written to the part
+// file before the line that covers them, so an interrupted run leaves
+// a journal that never claims more than was saved. Both files are
+// removed once the download completes cleanly.
+//////////////////////////////////////////////////////////////////////
+
+struct s_journal {
+	std::string	jpath;		// <path>.journal
+	std::string	ppath;		// <path>.part
+	FILE		*log;		// Journal, open for append
+	int		fd;		// Part file
+	std::vector<unsigned> saved;	// Per segment: leading bytes saved
+
+	s_journal() : log(0), fd(-1) {}
+	~s_journal() { close(); }
+
+	bool load(const s_eprom_type& etype,const char *path,unsigned char *image);
+	void start(const s_eprom_type& etype,const char *path,bool append);
+	void save(unsigned x,const s_segment& seg,const unsigned char *image,unsigned upto);
+	void close();
+	void remove();
+};
+
+static const unsigned journal_chunk = 1024;	// Bytes between progress saves
+
+void journal_discard(const char *path);	// Remove the journal of path
+bool journal_matches(s_unit& u,const s_eprom_type& etype,const s_journal& journal,const unsigned char *image);
+
+#endif // JOURNAL_HPP
+
+// End journal.hpp
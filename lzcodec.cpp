@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////
+// lzcodec.cpp -- Small built in LZ77 codec for image segments
+//
+// Greedy matching through a hash table of the last position each four
+// byte sequence was seen at. Not the densest coding there is, but a
+// segment compresses in one pass and decompresses with no tables, and
+// the erased (0xFF) and zero filled runs of EPROM images, which are
+// most of what there is to gain, become a sequence each.
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lzcodec.hpp"
+
+static const unsigned hash_bits = 14;
+static const unsigned min_match = 4;
+static const size_t max_offset = 65535;
+
+static inline uint32_t
+read32(const unsigned char *p) {
+	uint32_t v;
+
+	memcpy(&v,p,4);
+	return v;
+}
+
+static inline unsigned
+hash4(uint32_t v) {
+	return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+static void
+put_count(std::vector<unsigned char>& out,size_t count) {
+
+	while ( count >= 255 ) {
+		out.push_back(255);
+		count -= 255;
+	}
+	out.push_back(count);
+}
+
+//////////////////////////////////////////////////////////////////////
+// One sequence: nlit literals from lit, then a match (mlen 0: none)
+//////////////////////////////////////////////////////////////////////
+
+static void
+put_sequence(std::vector<unsigned char>& out,const unsigned char *lit,size_t nlit,size_t offset,size_t mlen) {
+	size_t mcode = mlen > 0 ? mlen - min_match : 0;
+
+	out.push_back((nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15));
+	if ( nlit >= 15 )
+		put_count(out,nlit - 15);
+	out.insert(out.end(),lit,lit + nlit);
+	if ( mlen == 0 )
+		return;
+	out.push_back(offset & 0xFF);
+	out.push_back(offset >> 8);
+	if ( mcode >= 15 )
+		put_count(out,mcode - 15);
+}
+
+size_t
+lz_compress(const unsigned char *src,size_t n,std::vector<unsigned char>& out) {
+	std::vector<long> table(1u << hash_bits,-1);
+	size_t ip = 0, anchor = 0;
+
+	out.clear();
+	while ( ip + min_match <= n ) {
+		uint32_t v = read32(src + ip);
+		unsigned h = hash4(v);
+		long cand = table[h];
+
+		table[h] = ip;
+		if ( cand < 0 || ip - cand > max_offset || read32(src + cand) != v ) {
+			++ip;
+			continue;
+		}
+
+		size_t len = min_match;
+
+		while ( ip + len < n && src[cand + len] == src[ip + len] )
+			++len;
+
+		put_sequence(out,src + anchor,ip - anchor,ip - cand,len);
+		ip += len;
+		anchor = ip;
+		if ( ip + 2 <= n )
+			table[hash4(read32(src + ip - 2))] = ip - 2;	// Keep the table fresh past a match
+	}
+
+	put_sequence(out,src + anchor,n - anchor,0,0);
+	return out.size();
+}
+
+static bool
+get_count(const unsigned char *& ip,const unsigned char *end,size_t& count) {
+	unsigned char b;
+
+	do	{
+		if ( ip >= end )
+			return false;
+		b = *ip++;
+		count += b;
+	} while ( b == 255 );
+	return true;
+}
+
+bool
+lz_decompress(const unsigned char *src,size_t n,unsigned char *dst,size_t len) {
+	const unsigned char *ip = src, *end = src + n;
+	size_t op = 0;
+
+	while ( ip < end ) {
+		unsigned token = *ip++;
+		size_t nlit = token >> 4, mlen = token & 0x0F;
+
+		if ( nlit == 15 && !get_count(ip,end,nlit) )
+			return false;
+		if ( nlit > size_t(end - ip) || nlit > len - op )
+			return false;
+		memcpy(dst + op,ip,nlit);
+		ip += nlit;
+		op += nlit;
+
+		if ( ip == end )
+			break;			// Last sequence: literals only
+
+		if ( end - ip < 2 )
+			return false;
+
+		size_t offset = ip[0] | ip[1] << 8;
+
+		ip += 2;
+		if ( mlen == 15 && !get_count(ip,end,mlen) )
+			return false;
+		mlen += min_match;
+		if ( offset == 0 || offset > op || mlen > len - op )
+			return false;
+
+		const unsigned char *from = dst + op - offset;
+
+		if ( offset >= mlen )
+			memcpy(dst + op,from,mlen);
+		else	for ( size_t x = 0; x < mlen; ++x )
+				dst[op + x] = from[x];	// Overlapping: repeats the pattern
+		op += mlen;
+	}
+	return op == len;
+}
+
+// End lzcodec.cpp
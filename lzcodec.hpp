@@ -0,0 +1,32 @@
+///////////////////////////////////////////////////////////////////////
+// lzcodec.hpp -- Small built in LZ77 codec for image segments
+///////////////////////////////////////////////////////////////////////
+
+#ifndef LZCODEC_HPP
+#define LZCODEC_HPP
+
+#include <stddef.h>
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+// A block is a run of sequences, each a token byte (literal count in
+// the high nibble, match length - 4 in the low one; 15 means more
+// count bytes follow, each adding up to 255), the literals, then a
+// 16 bit little endian match offset back into the output. The last
+// sequence is literals only. A match may overlap its own output, so
+// a run of 0xFF costs a few bytes whatever its length.
+//////////////////////////////////////////////////////////////////////
+
+size_t lz_compress(const unsigned char *src,size_t n,std::vector<unsigned char>& out);
+
+//////////////////////////////////////////////////////////////////////
+// Decompress a block into exactly len bytes at dst. Returns false if
+// the block is damaged (never reading or writing past either end).
+//////////////////////////////////////////////////////////////////////
+
+bool lz_decompress(const unsigned char *src,size_t n,unsigned char *dst,size_t len);
+
+#endif // LZCODEC_HPP
+
+// End lzcodec.hpp
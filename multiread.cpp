@@ -0,0 +1,271 @@
+///////////////////////////////////////////////////////////////////////
+// multiread.cpp -- Majority vote downloads from repeated reads
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "multiread.hpp"
+#include "perfmon.hpp"
+#include "updecode.hpp"
+#include "vote.hpp"
+
+static const unsigned max_listed = 32;		// Unstable bytes listed
+
+void
+multi_read(s_unit& u,const s_eprom_type& etype,unsigned reads,unsigned agree,s_multiread& mr) {
+	size_t size = image_size(etype);
+	std::vector<const unsigned char *> ptrs;
+	s_updecoder dec;
+
+	mr.pass.assign(reads,std::vector<unsigned char>(size,0xFF));
+	mr.npass.assign(etype.segs.size(),0);
+	mr.tries.assign(etype.segs.size(),0);
+	mr.major.assign(size,0xFF);
+	mr.unstable.assign(size,0);
+
+	unsigned x = 0;
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it, ++x ) {
+		unsigned& np = mr.npass[x];
+		unsigned run = 0;			// Consecutive identical passes
+
+		while ( mr.tries[x] < reads ) {
+			++mr.tries[x];
+			if ( verbose )
+				printf("Segment %s: read %u of up to %u\n",it->title.c_str(),mr.tries[x],reads);
+
+			upload_segment(u,etype,*it,mr.pass[np].data(),dec,0);
+			if ( !dec.valid() )
+				continue;		// Retried in the same slot
+
+			if ( np > 0 && !memcmp(mr.pass[np].data() + it->offset,mr.pass[np-1].data() + it->offset,etype.segsize) )
+				++run;
+			else	run = 1;
+			++np;
+
+			if ( agree > 0 && run >= agree )
+				break;
+		}
+
+		if ( np == 0 ) {
+			fprintf(stderr,"Segment %s: no clean read in %u tries\n",it->ppname.c_str(),mr.tries[x]);
+			exit(3);
+		}
+
+		ptrs.clear();
+		for ( unsigned p = 0; p < np; ++p )
+			ptrs.push_back(mr.pass[p].data() + it->offset);
+
+		const char *phase = perf_phase("vote");
+
+		vote(ptrs.data(),np,etype.segsize,mr.major.data() + it->offset,mr.unstable.data() + it->offset);
+		perf_phase(phase);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Weak bit report. A flip is a pass that read a bit differently from
+// its vote; a flip to 1 of a bit voted 0 is charge loss, the usual
+// way an EPROM cell decays. Only unstable bytes can have flips.
+//
+// path.weak is the text report. path.heat is the heat map, meant to
+// be memory mapped: a 64 byte header, a segment table, then one flip
+// count byte per bit of the image (8 per address, bit 0 first) at
+// data_offset. All fields are 32-bit little endian.
+//
+//	0	"PPHEAT1\0"	magic
+//	8	header_size	64
+//	12	image_size	bytes in the image
+//	16	nsegs		segment table entries (16 bytes each, at 64)
+//	20	data_offset	start of the counts
+//	24	max_passes	largest pass count of any segment
+//	[64]	offset, size, passes, tries per segment
+//////////////////////////////////////////////////////////////////////
+
+static void
+put32(unsigned char *p,unsigned v) {
+
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void
+weak_report(const s_eprom_type& etype,const s_multiread& mr,const char *path) {
+	size_t size = mr.major.size();
+	unsigned nsegs = etype.segs.size();
+	unsigned data_offset = (64 + 16 * nsegs + 63) & ~63u;
+	std::vector<unsigned char> heat(data_offset + size * 8,0);
+	std::string wpath = std::string(path) + ".weak";
+	std::string hpath = std::string(path) + ".heat";
+	unsigned max_passes = 0, x = 0;
+	FILE *f = fopen(wpath.c_str(),"w");
+
+	if ( !f ) {
+		fprintf(stderr,"%s: Writing %s\n",strerror(errno),wpath.c_str());
+		exit(2);
+	}
+
+	fprintf(f,"# Weak bit report for %s (%s)\n",path,etype.name.c_str());
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it, ++x ) {
+		unsigned np = mr.npass[x];
+		unsigned long ubytes = 0, ubits = 0, flips = 0, loss = 0;
+		unsigned long bitpos[8] = { 0 };
+		unsigned worst = 0, worst_addr = it->offset;
+
+		if ( np > max_passes )
+			max_passes = np;
+		put32(&heat[64 + 16 * x],it->offset);
+		put32(&heat[64 + 16 * x + 4],etype.segsize);
+		put32(&heat[64 + 16 * x + 8],np);
+		put32(&heat[64 + 16 * x + 12],mr.tries[x]);
+
+		fprintf(f,"\nSegment %s (%s) at 0x%04X: %u clean passes of %u reads\n",
+			it->ppname.c_str(),
+			it->title.c_str(),
+			it->offset,
+			np,
+			mr.tries[x]);
+
+		for ( unsigned a = it->offset; a < it->offset + etype.segsize; ++a ) {
+			unsigned char ub = mr.unstable[a];
+			unsigned total = 0;
+
+			if ( !ub )
+				continue;
+			++ubytes;
+
+			fprintf(f,"  0x%04X voted 0x%02X:",a,mr.major[a]);
+			for ( unsigned b = 0; b < 8; ++b ) {
+				unsigned n = 0;
+
+				if ( !(ub >> b & 1) )
+					continue;
+				for ( unsigned p = 0; p < np; ++p )
+					n += ((mr.pass[p][a] ^ mr.major[a]) >> b) & 1;
+				heat[data_offset + size_t(a) * 8 + b] = n;
+				++ubits;
+				++bitpos[b];
+				flips += n;
+				total += n;
+				if ( !(mr.major[a] >> b & 1) )
+					loss += n;
+				fprintf(f," bit%u %u/%u%s",b,n,np,mr.major[a] >> b & 1 ? "" : " (loss)");
+			}
+			fputc('\n',f);
+			if ( total > worst ) {
+				worst = total;
+				worst_addr = a;
+			}
+		}
+
+		double cells = double(etype.segsize) * 8.0 * (np ? np : 1);
+
+		fprintf(f,"  Unstable: %lu bytes, %lu bits; %lu flips (%lu charge loss), rate %.3g per bit read\n",
+			ubytes,
+			ubits,
+			flips,
+			loss,
+			flips / cells);
+		if ( ubits ) {
+			fprintf(f,"  Worst: 0x%04X with %u flips; unstable bits by position:",worst_addr,worst);
+			for ( unsigned b = 0; b < 8; ++b )
+				fprintf(f," %lu",bitpos[b]);
+			fputc('\n',f);
+		}
+
+		printf("Segment %s: %lu unstable bits, %lu flips (%lu charge loss)\n",
+			it->title.c_str(),
+			ubits,
+			flips,
+			loss);
+	}
+	fclose(f);
+
+	memcpy(&heat[0],"PPHEAT1",8);
+	put32(&heat[8],64);
+	put32(&heat[12],size);
+	put32(&heat[16],nsegs);
+	put32(&heat[20],data_offset);
+	put32(&heat[24],max_passes);
+
+	if ( !(f = fopen(hpath.c_str(),"w")) || fwrite(heat.data(),1,heat.size(),f) != heat.size() ) {
+		fprintf(stderr,"%s: Writing %s\n",strerror(errno),hpath.c_str());
+		exit(2);
+	}
+	fclose(f);
+
+	printf("Weak bit report in %s, heat map in %s\n",wpath.c_str(),hpath.c_str());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Download with --reads: write the majority image to path and the
+// unstable bit map (one mask byte per image byte) to path.unstable.
+// With weak, also the weak bit report and heat map.
+//////////////////////////////////////////////////////////////////////
+
+void
+download_voted(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,unsigned reads,unsigned agree,bool weak) {
+	s_multiread mr;
+
+	if ( fmt == FMT_NONE )
+		fmt = imgfmt_from_path(path);
+	if ( fmt == FMT_TEXT ) {
+		fputs("--reads writes a voted image: use a bin, ihex or srec output\n",stderr);
+		exit(1);
+	}
+
+	multi_read(u,etype,reads,agree,mr);
+	putchar('\n');
+
+	unsigned long nbits = 0, listed = 0;
+	unsigned x = 0;
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it, ++x ) {
+		unsigned long segbits = 0;
+
+		for ( unsigned a = it->offset; a < it->offset + etype.segsize; ++a )
+			segbits += __builtin_popcount(mr.unstable[a]);
+		printf("Segment %s: %u clean of %u reads, %lu unstable bits\n",
+			it->title.c_str(),
+			mr.npass[x],
+			mr.tries[x],
+			segbits);
+		nbits += segbits;
+	}
+
+	for ( size_t a = 0; a < mr.unstable.size(); ++a ) {
+		if ( !mr.unstable[a] )
+			continue;
+		if ( ++listed > max_listed ) {
+			puts("  ...");
+			break;
+		}
+		printf("  0x%04X: voted 0x%02X, unstable bits 0x%02X\n",unsigned(a),mr.major[a],mr.unstable[a]);
+	}
+
+	write_image(etype,mr.major.data(),path,fmt);
+
+	std::string upath = std::string(path) + ".unstable";
+	FILE *f = fopen(upath.c_str(),"w");
+
+	if ( !f || fwrite(mr.unstable.data(),1,mr.unstable.size(),f) != mr.unstable.size() ) {
+		fprintf(stderr,"%s: Writing %s\n",
+			strerror(errno),
+			upath.c_str());
+		exit(2);
+	}
+	fclose(f);
+
+	printf("%lu unstable bits (map in %s, %s vote kernel)\n",nbits,upath.c_str(),vote_best());
+
+	if ( weak )
+		weak_report(etype,mr,path);
+}
+
+// End multiread.cpp
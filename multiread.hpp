@@ -0,0 +1,31 @@
+///////////////////////////////////////////////////////////////////////
+// multiread.hpp -- Repeated reads of an EPROM
+///////////////////////////////////////////////////////////////////////
+
+#ifndef MULTIREAD_HPP
+#define MULTIREAD_HPP
+
+#include <vector>
+
+#include "prompro.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Each segment is loaded from the chip and uploaded up to reads times
+// (each pass is a fresh L, so the chip itself is re-read). A segment
+// stops early once agree consecutive passes are identical (0: never).
+// Passes that fail to decode cleanly are dropped.
+//////////////////////////////////////////////////////////////////////
+
+struct s_multiread {
+	std::vector<std::vector<unsigned char> > pass;	// Full images, per pass
+	std::vector<unsigned>	npass;		// Clean passes, per segment
+	std::vector<unsigned>	tries;		// Uploads made, per segment
+	std::vector<unsigned char> major;	// Majority vote image
+	std::vector<unsigned char> unstable;	// Bits not read the same every pass
+};
+
+void multi_read(s_unit& u,const s_eprom_type& etype,unsigned reads,unsigned agree,s_multiread& mr);
+
+#endif // MULTIREAD_HPP
+
+// End multiread.hpp
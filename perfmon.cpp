@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////
+// perfmon.cpp -- Per-phase host cost accounting (perf_event_open)
+//
+// Each phase of a job is charged its wall time, process CPU time and,
+// on Linux, the cycles, instructions, context switches and page faults
+// counted by perf_event_open(). Counters that the kernel refuses (no
+// PMU in a VM, perf_event_paranoid) are reported as n/a.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perfmon.hpp"
+#include "prompro.hpp"
+
+#include <string>
+#include <vector>
+
+struct s_perfctr {
+	const char	*name;		// Column heading
+	uint32_t	type;		// PERF_TYPE_*
+	uint64_t	config;		// PERF_COUNT_*
+	int		fd;		// Counter fd, else -1
+};
+
+#ifdef __linux__
+static s_perfctr ctrs[] = {
+	{ "Cycles",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CPU_CYCLES,	-1 },
+	{ "Instrs",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_INSTRUCTIONS,	-1 },
+	{ "CtxSw",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CONTEXT_SWITCHES,	-1 },
+	{ "PgFlt",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_PAGE_FAULTS,	-1 },
+};
+#else
+static s_perfctr ctrs[] = {
+	{ "Cycles",	0,	0,	-1 },
+	{ "Instrs",	0,	0,	-1 },
+	{ "CtxSw",	0,	0,	-1 },
+	{ "PgFlt",	0,	0,	-1 },
+};
+#endif
+
+static const unsigned n_ctrs = sizeof ctrs / sizeof ctrs[0];
+
+struct s_phasestat {
+	std::string	name;
+	unsigned long	entries;	// Times the phase was entered
+	double		secs;		// Wall time
+	double		cpu;		// Process CPU time
+	uint64_t	v[sizeof ctrs / sizeof ctrs[0]];
+};
+
+static bool enabled = false;
+static std::vector<s_phasestat> phases;		// In order of first use
+static const char *cur_phase = "other";
+static double t_mark, cpu_mark;			// Values at last switch
+static pthread_t main_thread = pthread_self();	// The one thread phases follow
+static uint64_t v_mark[sizeof ctrs / sizeof ctrs[0]];
+
+static double
+cpu_secs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+static uint64_t
+read_ctr(const s_perfctr& c) {
+	uint64_t v = 0;
+
+	if ( c.fd >= 0 && read(c.fd,&v,sizeof v) != sizeof v )
+		v = 0;
+	return v;
+}
+
+static s_phasestat&
+phase_stat(const char *name) {
+
+	for ( auto it = phases.begin(); it != phases.end(); ++it )
+		if ( it->name == name )
+			return *it;
+
+	s_phasestat ps;
+
+	ps.name = name;
+	ps.entries = 0;
+	ps.secs = ps.cpu = 0.0;
+	memset(ps.v,0,sizeof ps.v);
+	phases.push_back(ps);
+	return phases.back();
+}
+
+#ifdef __linux__
+static int
+open_ctr(const s_perfctr& c) {
+	struct perf_event_attr attr;
+
+	memset(&attr,0,sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = c.type;
+	attr.config = c.config;
+	attr.exclude_kernel = c.type == PERF_TYPE_HARDWARE;
+	attr.exclude_hv = 1;
+	attr.inherit = 1;			// Include threads started later
+
+	return int(syscall(__NR_perf_event_open,&attr,0,-1,-1,0));
+}
+#endif
+
+void
+perf_open() {
+
+	if ( enabled )
+		return;
+
+#ifdef __linux__
+	for ( unsigned x=0; x<n_ctrs; ++x ) {
+		ctrs[x].fd = open_ctr(ctrs[x]);
+		if ( ctrs[x].fd < 0 && verbose )
+			fprintf(stderr,"perf_event_open(%s): %s\n",ctrs[x].name,strerror(errno));
+	}
+#else
+	if ( verbose )
+		fputs("perf_event_open() not available: reporting time only\n",stderr);
+#endif
+
+	enabled = true;
+	t_mark = now_secs();
+	cpu_mark = cpu_secs();
+	for ( unsigned x=0; x<n_ctrs; ++x )
+		v_mark[x] = read_ctr(ctrs[x]);
+
+	atexit(perf_report);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Charge the time and counts since the last mark to the current phase
+//////////////////////////////////////////////////////////////////////
+
+static void
+charge() {
+	double t = now_secs(), cpu = cpu_secs();
+	s_phasestat& ps = phase_stat(cur_phase);
+
+	ps.secs += t - t_mark;
+	ps.cpu += cpu - cpu_mark;
+	for ( unsigned x=0; x<n_ctrs; ++x ) {
+		uint64_t v = read_ctr(ctrs[x]);
+
+		ps.v[x] += v - v_mark[x];
+		v_mark[x] = v;
+	}
+	t_mark = t;
+	cpu_mark = cpu;
+}
+
+const char *
+perf_phase(const char *name) {
+
+	if ( !pthread_equal(pthread_self(),main_thread) )
+		return name;			// Worker threads are not phased
+
+	const char *prev = cur_phase;
+
+	if ( enabled && strcmp(name,prev) != 0 ) {
+		charge();
+		phase_stat(name).entries++;
+	}
+
+	cur_phase = name;
+	return prev;
+}
+
+void
+perf_report() {
+	static bool reported = false;
+
+	if ( !enabled || reported )
+		return;
+	reported = true;
+
+	charge();
+
+	printf("\nPer-phase host cost:\n");
+	printf("%-10s %7s %9s %9s %6s","Phase","Entries","Wall s","CPU s","CPU%");
+	for ( unsigned x=0; x<n_ctrs; ++x )
+		printf(" %12s",ctrs[x].name);
+	printf(" %6s\n","IPC");
+
+	for ( auto it = phases.begin(); it != phases.end(); ++it ) {
+		const s_phasestat& ps = *it;
+
+		if ( ps.secs <= 0.0 )
+			continue;
+
+		printf("%-10s %7lu %9.3f %9.3f %6.1f",
+			ps.name.c_str(),
+			ps.entries,
+			ps.secs,
+			ps.cpu,
+			100.0 * ps.cpu / ps.secs);
+		for ( unsigned x=0; x<n_ctrs; ++x ) {
+			if ( ctrs[x].fd >= 0 )
+				printf(" %12llu",(unsigned long long)ps.v[x]);
+			else	printf(" %12s","n/a");
+		}
+		if ( ctrs[0].fd >= 0 && ctrs[1].fd >= 0 && ps.v[0] > 0 )
+			printf(" %6.2f\n",double(ps.v[1]) / ps.v[0]);
+		else	printf(" %6s\n","n/a");
+	}
+	fflush(stdout);
+}
+
+// End perfmon.cpp
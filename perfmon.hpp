@@ -0,0 +1,29 @@
+///////////////////////////////////////////////////////////////////////
+// perfmon.hpp -- Per-phase host cost accounting (perf_event_open)
+///////////////////////////////////////////////////////////////////////
+
+#ifndef PERFMON_HPP
+#define PERFMON_HPP
+
+//////////////////////////////////////////////////////////////////////
+// perf_open() enables accounting and arranges for perf_report() to
+// run at exit. perf_phase() charges everything since the last switch
+// to the current phase, makes name current and returns the previous
+// phase name, so callers can restore it:
+//
+//	const char *prev = perf_phase("load");
+//	...
+//	perf_phase(prev);
+//
+// When accounting is not enabled, perf_phase() only tracks the name.
+// Phases follow the main thread: on other threads perf_phase() does
+// nothing (their counts land in whatever phase the main thread is in).
+//////////////////////////////////////////////////////////////////////
+
+void perf_open();
+const char *perf_phase(const char *name);
+void perf_report();
+
+#endif // PERFMON_HPP
+
+// End perfmon.hpp
@@ -0,0 +1,285 @@
+///////////////////////////////////////////////////////////////////////
+// ppzfile.cpp -- Compressed image container with per segment access
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ppzfile.hpp"
+#include "lzcodec.hpp"
+#include "digest.hpp"
+
+#include <map>
+#include <vector>
+
+static const unsigned char ppz_magic[4] = { 'P', 'P', 'Z', '1' };
+static const unsigned ppz_version = 1;
+static const unsigned hdr_size = 32;
+static const unsigned ent_size = 24;
+
+static void
+put32(unsigned char *p,unsigned v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+static unsigned
+get32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | unsigned(p[3]) << 24;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Writer: each segment is compressed and written as it arrives (kept
+// stored when that is no smaller); the index and header go out last.
+//////////////////////////////////////////////////////////////////////
+
+struct s_ppzwriter : s_imgwriter {
+	unsigned	pos;		// File offset of the next data
+	std::map<unsigned,s_ppzseg> segs; // By address
+	std::vector<unsigned char> packed;
+
+	s_ppzwriter(FILE *out,unsigned image_size) : s_imgwriter(out,image_size), pos(hdr_size) {
+		unsigned char hdr[hdr_size] = { 0 };
+
+		fwrite(hdr,1,sizeof hdr,out);	// Written for real by finish()
+	}
+
+	void segment(unsigned addr,const unsigned char *data,unsigned n,const std::string&) {
+		s_ppzseg s;
+		s_crc32 crc;
+
+		crc.update(data,n);
+		s.addr = addr;
+		s.len = n;
+		s.offset = pos;
+		s.crc = crc.final();
+
+		if ( lz_compress(data,n,packed) < n ) {
+			s.method = PPZ_LZ;
+			s.clen = packed.size();
+			data = packed.data();
+		} else	{
+			s.method = PPZ_STORED;
+			s.clen = n;
+		}
+
+		fseek(out,pos,SEEK_SET);
+		fwrite(data,1,s.clen,out);
+		pos += s.clen;
+		segs[addr] = s;			// A segment read again replaces the last
+	}
+
+	bool finish() {
+		std::vector<unsigned char> index(segs.size() * ent_size);
+		unsigned char hdr[hdr_size] = { 0 }, *p = index.data();
+		unsigned ioff = (pos + 7) & ~7u;
+		s_crc32 crc;
+
+		for ( auto it = segs.begin(); it != segs.end(); ++it, p += ent_size ) {
+			put32(p,it->second.addr);
+			put32(p + 4,it->second.len);
+			put32(p + 8,it->second.offset);
+			put32(p + 12,it->second.clen);
+			put32(p + 16,it->second.crc);
+			put32(p + 20,it->second.method);
+		}
+		crc.update(index.data(),index.size());
+
+		memcpy(hdr,ppz_magic,4);
+		put32(hdr + 4,ppz_version);
+		put32(hdr + 8,image_size);
+		put32(hdr + 12,segs.size());
+		put32(hdr + 16,ioff);
+		put32(hdr + 20,crc.final());
+
+		fseek(out,pos,SEEK_SET);
+		while ( pos < ioff ) {
+			fputc(0,out);
+			++pos;
+		}
+		fwrite(index.data(),1,index.size(),out);
+		fseek(out,0,SEEK_SET);
+		fwrite(hdr,1,sizeof hdr,out);
+		return fflush(out) == 0;
+	}
+};
+
+s_imgwriter *
+ppz_writer_new(FILE *out,unsigned image_size) {
+	return new s_ppzwriter(out,image_size);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reader
+//////////////////////////////////////////////////////////////////////
+
+const char *
+s_ppzfile::open(const char *path) {
+	struct stat st;
+	void *m;
+	int fd;
+
+	close();
+	fd = ::open(path,O_RDONLY);
+	if ( fd == -1 || fstat(fd,&st) == -1 ) {
+		if ( fd != -1 )
+			::close(fd);
+		return strerror(errno);
+	}
+	if ( st.st_size < hdr_size ) {
+		::close(fd);
+		return "not a ppz image";
+	}
+	m = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	::close(fd);
+	if ( m == MAP_FAILED )
+		return strerror(errno);
+	map = (const unsigned char *)m;
+	maplen = st.st_size;
+
+	unsigned ioff = get32(map + 16);
+
+	if ( memcmp(map,ppz_magic,4) != 0 ) {
+		close();
+		return "not a ppz image";
+	}
+	if ( get32(map + 4) != ppz_version ) {
+		close();
+		return "unsupported ppz version";
+	}
+	size = get32(map + 8);
+	nsegs = get32(map + 12);
+	if ( ioff < hdr_size || ioff > maplen || (maplen - ioff) / ent_size < nsegs ) {
+		close();
+		return "ppz index is truncated";
+	}
+	index = map + ioff;
+
+	s_crc32 crc;
+
+	crc.update(index,size_t(nsegs) * ent_size);
+	if ( crc.final() != get32(map + 20) ) {
+		close();
+		return "ppz index is damaged";
+	}
+
+	for ( unsigned x = 0; x < nsegs; ++x ) {
+		s_ppzseg s = seg(x);
+
+		if ( s.offset < hdr_size || s.offset > ioff || s.clen > ioff - s.offset
+		  || s.addr > size || s.len > size - s.addr
+		  || (x > 0 && s.addr < seg(x - 1).addr + seg(x - 1).len)
+		  || (s.method == PPZ_STORED && s.clen != s.len) || s.method > PPZ_LZ ) {
+			close();
+			return "ppz index is inconsistent";
+		}
+	}
+	return 0;
+}
+
+void
+s_ppzfile::close() {
+
+	if ( map )
+		munmap((void *)map,maplen);
+	map = index = 0;
+	maplen = 0;
+	size = nsegs = 0;
+}
+
+s_ppzseg
+s_ppzfile::seg(unsigned x) const {
+	const unsigned char *p = index + size_t(x) * ent_size;
+	s_ppzseg s;
+
+	s.addr = get32(p);
+	s.len = get32(p + 4);
+	s.offset = get32(p + 8);
+	s.clen = get32(p + 12);
+	s.crc = get32(p + 16);
+	s.method = get32(p + 20);
+	return s;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Binary search of the mapped index
+//////////////////////////////////////////////////////////////////////
+
+int
+s_ppzfile::find(unsigned addr) const {
+	unsigned lo = 0, hi = nsegs;
+
+	while ( lo < hi ) {
+		unsigned mid = lo + (hi - lo) / 2;
+		s_ppzseg s = seg(mid);
+
+		if ( addr < s.addr )
+			hi = mid;
+		else if ( addr - s.addr >= s.len )
+			lo = mid + 1;
+		else	return mid;
+	}
+	return -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decompress segment x (seg(x).len bytes) and check its CRC
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_ppzfile::read_seg(unsigned x,unsigned char *out) const {
+	s_ppzseg s = seg(x);
+	s_crc32 crc;
+
+	if ( s.method == PPZ_STORED )
+		memcpy(out,map + s.offset,s.len);
+	else if ( !lz_decompress(map + s.offset,s.clen,out,s.len) )
+		return false;
+
+	crc.update(out,s.len);
+	return crc.final() == s.crc;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Image bytes [addr,addr+len): only the segments they touch are
+// decompressed, and bytes no segment holds are erased
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_ppzfile::read(unsigned addr,unsigned len,unsigned char *out) const {
+	std::vector<unsigned char> buf;
+
+	memset(out,0xFF,len);
+	for ( unsigned x = 0; x < nsegs; ++x ) {
+		s_ppzseg s = seg(x);
+
+		if ( s.addr >= addr + len )
+			break;
+		if ( s.addr + s.len <= addr )
+			continue;
+
+		unsigned from = s.addr > addr ? s.addr : addr;
+		unsigned to = s.addr + s.len < addr + len ? s.addr + s.len : addr + len;
+
+		if ( from == s.addr && to == s.addr + s.len ) {
+			if ( !read_seg(x,out + (from - addr)) )
+				return false;
+			continue;
+		}
+		buf.resize(s.len);
+		if ( !read_seg(x,buf.data()) )
+			return false;
+		memcpy(out + (from - addr),buf.data() + (from - s.addr),to - from);
+	}
+	return true;
+}
+
+// End ppzfile.cpp
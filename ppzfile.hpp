@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////
+// ppzfile.hpp -- Compressed image container with per segment access
+///////////////////////////////////////////////////////////////////////
+
+#ifndef PPZFILE_HPP
+#define PPZFILE_HPP
+
+#include <stdio.h>
+
+#include "imgfmt.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// A .ppz file holds an image as segments compressed one by one, so
+// any segment can be read without the others. All numbers are 32 bit
+// little endian:
+//
+//	0	"PPZ1"		Magic
+//	4	version		1
+//	8	image size	Size of the whole part
+//	12	segments	Index entries
+//	16	index offset	8 byte aligned, after the segment data
+//	20	index crc	CRC-32 of the index entries
+//	24	0, 0		Reserved
+//	32	...		Segment data, in the order it arrived
+//
+// The index is sorted by address, 24 bytes an entry:
+//
+//	address, length, data offset, data length, crc, method
+//
+// crc is the CRC-32 of the segment bytes (two images can be compared
+// segment by segment from their indexes alone), method 0 for stored,
+// 1 for lzcodec. Addresses no segment covers read as erased (0xFF).
+//////////////////////////////////////////////////////////////////////
+
+enum e_ppzmethod {
+	PPZ_STORED = 0,
+	PPZ_LZ = 1
+};
+
+struct s_ppzseg {
+	unsigned	addr;		// Image address
+	unsigned	len;		// Bytes of image
+	unsigned	offset;		// Of the data in the file
+	unsigned	clen;		// Bytes of data
+	unsigned	crc;		// CRC-32 of the image bytes
+	unsigned	method;		// e_ppzmethod
+};
+
+s_imgwriter *ppz_writer_new(FILE *out,unsigned image_size);
+
+//////////////////////////////////////////////////////////////////////
+// A .ppz file mapped for reading. Segments are decompressed only when
+// asked for; the index is read where it lies in the mapping.
+//////////////////////////////////////////////////////////////////////
+
+struct s_ppzfile {
+	unsigned	size;		// Image size
+	unsigned	nsegs;		// Index entries
+
+	s_ppzfile() : size(0), nsegs(0), map(0), maplen(0), index(0) {}
+	~s_ppzfile() { close(); }
+
+	const char *open(const char *path);	// Null, else why not
+	void close();
+
+	s_ppzseg seg(unsigned x) const;		// Index entry x
+	int find(unsigned addr) const;		// Entry holding addr, else -1
+	bool read_seg(unsigned x,unsigned char *out) const;
+	bool read(unsigned addr,unsigned len,unsigned char *out) const;
+
+private:
+	s_ppzfile(const s_ppzfile&);		// Owns the mapping: not copied
+	s_ppzfile& operator=(const s_ppzfile&);
+
+	const unsigned char *map;
+	size_t		maplen;
+	const unsigned char *index;
+};
+
+#endif // PPZFILE_HPP
+
+// End ppzfile.hpp
@@ -1,413 +1,992 @@
 ///////////////////////////////////////////////////////////////////////
 // prompro.cpp -- Main program for Prompro-8 EPROM Programmer
-// Date: Sun Feb  8 16:34:07 2015  (C) Warren W. Gay VE3WWG 
+// Date: Sun Feb  8 16:34:07 2015  (C) Warren W. Gay VE3WWG
 ///////////////////////////////////////////////////////////////////////
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
 #include <fcntl.h>
-#include <termios.h>
 #include <poll.h>
 
 #include "pugixml.hpp"
+#include "prompro.hpp"
+#include "perfmon.hpp"
+#include "vote.hpp"
+#include "sched.hpp"
+#include "gang.hpp"
+#include "segplan.hpp"
+#include "archive.hpp"
 
 #include <string>
 #include <map>
 #include <vector>
+#include <thread>
 
 // static unsigned block_size = 2048;		// PROMPRO "block size"
-static bool cmd_debug = false;			// When true, show serial trafic for debugging
 static bool xml_loaded = false;
-static bool verbose = false;			// Verbose messages when true
-static unsigned baud_rate = 0;
-static bool rtscts = false;
-static std::string device;
-static struct termios term;
-static int rtimeout_ms = 2000;			// Read timeout in ms
 static std::string eprom_type;			// EPROM type
-static std::string prompro_type;		// Current prompro-8 EPROM type
+static std::string opt_eprom_type;		// EPROM type given by -e
 static std::string download;			// Download file name
-
-static int serial = -1;
-
-struct s_segment {
-	std::string	ppname;			// Prompro name
-	unsigned	offset;			// Byte offset
-	std::string	title;			// As shown on PROMPRO-8
-};
-
-struct s_eprom_type {
-	std::string		name;		// Config name for this EPROM
-	unsigned		segsize;	// Segment size
-	std::vector<s_segment>	segs;		// Segment description
-};
+static e_imgfmt download_fmt = FMT_NONE;	// Output format (-f), else by extension
+static std::string text_dump;			// Archived upload text to convert (-x)
+static std::string verify;			// Reference image to verify against (-V)
+static bool verify_abort = false;		// Stop verify at the first difference (-A)
+static bool blank = false;			// Blank check (-B)
+static bool range = false;			// Partial read (--range)
+static unsigned range_start = 0;
+static unsigned range_len = 0;
+static bool fingerprint = false;		// Sampled identification (--fingerprint)
+static unsigned fp_windows = 16;		// Sample windows (--samples NxW)
+static unsigned fp_wsize = 64;			// Bytes per sample window
+static std::string known_dir;			// Known images to match (--known)
+static std::string cache_dir;			// Fingerprint cache (--cache)
+static unsigned confidence = 16;		// Cache hit confirmation windows
+static unsigned reads = 1;			// Reads per segment to vote on (--reads)
+static unsigned agree = 2;			// Identical reads that end voting early
+static bool weak = false;			// Weak bit report (--weak)
+static bool resume = false;			// Continue a journaled download (--resume)
+static std::string batch_file;			// Chips to read in one session (--batch)
+static unsigned tray = 0;			// Chips to read to numbered -d files (--tray)
+static bool gang = false;			// Batch on every unit at once (--gang)
+static std::string archive_dir;			// Deduplicated dump archive (--archive)
+static bool archive_import_files = false;	// Import the file arguments (--import)
+static std::string archive_lookup_file;		// Image to look up (--seen)
+static std::string archive_extract_sha;		// Image to rebuild to -d (--extract)
+static bool diff_files = false;			// Compare the two file arguments (--diff)
+static bool show_metrics = false;		// Report wire efficiency at exit
+static bool show_perf = false;			// Report per-phase host cost at exit
+static std::string unit_name;			// Programmer unit to use (-u)
+static int keepalive_ms = -1;			// Keepalive interval override (-K)
 
 static s_eprom_type	*eprom = 0;		// Currently selected EPROM type
 
 static std::map<std::string,s_eprom_type> eproms;
 
-//////////////////////////////////////////////////////////////////////
-// Wait for any key
-//////////////////////////////////////////////////////////////////////
-
-static void
-anykey() {
-	char ch;
-	int rc;
-
-	do	{
-		rc = read(0,&ch,1);
-	} while ( rc == -1 && errno == EINTR );
-}
+static std::vector<s_unit> units;		// Configured programmers
+static s_programmer programmer;			// Buffer and type codes, for plans
 
 //////////////////////////////////////////////////////////////////////
-// Poll for input:
+// Wait for the operator to enter a line, while servicing the serial
+// units (pending command replies, keepalives, hangups, timeouts) in
+// the same loop.
 // Returns:
-//	1	At least one byte available to be read
-//	0	Timeout occurred
-//	-1	Error occurred (dev no longer open?)
+//	1	A line was entered
+//	0	EOF on stdin
+//	-1	The watched unit became unhealthy (line is empty)
 //////////////////////////////////////////////////////////////////////
 
 static int
-pollch(int timeout_ms) {
-        struct pollfd pinfo;
-	int rc;
+operator_wait(const char *prompt,std::string& line,s_unit *watch=0) {
+	static std::string opbuf;		// Operator input not yet consumed
+	static bool op_eof = false;
+	const int tick_ms = 100;
+	const char *phase = perf_phase("operator");
+
+	puts(prompt);
+	fflush(stdout);
+
+	for (;;) {
+		size_t nl = opbuf.find('\n');
+
+		if ( nl != std::string::npos ) {
+			line = opbuf.substr(0,nl);
+			opbuf.erase(0,nl+1);
+			if ( line.size() > 0 && line[line.size()-1] == '\r' )
+				line.erase(line.size()-1);
+			perf_phase(phase);
+			return 1;
+		}
+
+		if ( op_eof ) {
+			line = opbuf;
+			opbuf.clear();
+			perf_phase(phase);
+			return 0;
+		}
 
-        pinfo.fd = serial;
-        pinfo.events = POLLIN;
-        pinfo.revents = 0;
+		if ( watch && !watch->healthy ) {
+			line.clear();
+			perf_phase(phase);
+			return -1;
+		}
 
-	rc = poll(&pinfo,1,timeout_ms);
+		std::vector<struct pollfd> fds;
+		std::vector<s_unit*> polled;
+		struct pollfd pfd;
+		int timeout_ms = tick_ms;
+		double now = now_secs();
 
-	if ( rc < 1 && cmd_debug ) {
-		fprintf(stderr,"poll(timeout=%d ms) returned %d",timeout_ms,rc);
-		if ( rc < 0 )
-			fprintf(stderr," (%s)\n",strerror(errno));
-		else	fputc('\n',stderr);
-		fflush(stderr);
-	}
+		pfd.fd = 0;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
 
-	return rc;
+		for ( auto it = units.begin(); it != units.end(); ++it ) {
+			s_unit& u = *it;
+
+			if ( u.owned || u.fd < 0 || !u.healthy )
+				continue;
+			if ( u.busy ) {
+				int left = int((u.deadline - now) * 1000.0) + 1;
+
+				if ( left < timeout_ms )
+					timeout_ms = left > 0 ? left : 0;
+			}
+			pfd.fd = u.fd;
+			fds.push_back(pfd);
+			polled.push_back(&u);
+		}
+
+		int rc = poll(fds.data(),fds.size(),timeout_ms);
+
+		if ( rc < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			fprintf(stderr,"%s: poll() for operator input\n",strerror(errno));
+			exit(3);
+		}
+
+		if ( fds[0].revents ) {
+			char buf[256];
+			int n;
+
+			do	{
+				n = read(0,buf,sizeof buf);
+			} while ( n == -1 && errno == EINTR );
+
+			if ( n <= 0 )
+				op_eof = true;
+			else	opbuf.append(buf,n);
+		}
+
+		for ( size_t x=1; x<fds.size(); ++x ) {
+			s_unit& u = *polled[x-1];
+
+			if ( fds[x].revents & POLLIN ) {
+				if ( !service_unit(u) && u.healthy ) {
+					fprintf(stderr,"Unit %s (%s) closed.\n",u.name.c_str(),u.device.c_str());
+					if ( u.busy )
+						command_done(u,false);
+					u.healthy = false;
+				}
+			} else if ( fds[x].revents & (POLLHUP|POLLERR|POLLNVAL) ) {
+				fprintf(stderr,"Unit %s (%s) hung up.\n",u.name.c_str(),u.device.c_str());
+				if ( u.busy )
+					command_done(u,false);
+				u.healthy = false;
+			}
+		}
+
+		now = now_secs();
+		for ( auto it = units.begin(); it != units.end(); ++it ) {
+			s_unit& u = *it;
+
+			if ( u.owned )
+				continue;
+			if ( u.busy && now >= u.deadline )
+				command_done(u,false);
+			keepalive(u,now);
+		}
+	}
 }
 
-//////////////////////////////////////////////////////////////////////
-// Read 1 byte else timeout (-1 is return upon timeout)
-//////////////////////////////////////////////////////////////////////
+static void
+load_xml(const char *pathname) {
+	pugi::xml_document doc;
+	pugi::xml_parse_result res;
 
-static int
-readch(int timeout) {
-	int rc = pollch(timeout);
-	unsigned char ch;
+	res = doc.load_file(pathname);
+	if ( !res ) {
+		fprintf(stderr,"ERROR %s: at file offset %ld of file %s\n",
+			res.description(),
+			res.offset,
+			pathname);
+		return;
+	}
+
+	pugi::xml_node prompro_node = doc.child("prompro");
 
-	if ( rc == -1 ) {
-		fprintf(stderr,"ERROR %s: reading device %s\n",
-			strerror(errno),
-			device.c_str());
-		exit(3);
+	//////////////////////////////////////////////////////////////
+	// Each <serial> entry is one attached programmer. A later
+	// config file with <serial> entries replaces the earlier list.
+	//////////////////////////////////////////////////////////////
+
+	if ( prompro_node.child("serial") ) {
+		std::vector<s_unit> cfg_units;
+
+		for ( pugi::xml_node serial_node = prompro_node.child("serial"); serial_node; serial_node = serial_node.next_sibling("serial") ) {
+			pugi::xml_attribute name_attr = serial_node.attribute("name");
+			pugi::xml_attribute baud_attr = serial_node.attribute("baud");
+			pugi::xml_attribute device_attr = serial_node.attribute("device");
+			pugi::xml_attribute rtscts_attr = serial_node.attribute("rtscts");
+			pugi::xml_attribute keepalive_attr = serial_node.attribute("keepalive");
+			pugi::xml_attribute ktimeout_attr = serial_node.attribute("ktimeout");
+			s_unit u;
+
+			if ( !baud_attr.empty() )
+				u.baud_rate = baud_attr.as_uint();
+			if ( !device_attr.empty() )
+				u.device = device_attr.value();
+			if ( !rtscts_attr.empty() )
+				u.rtscts = !!rtscts_attr.as_int();
+			if ( !keepalive_attr.empty() )
+				u.keepalive_ms = keepalive_attr.as_int();
+			if ( !ktimeout_attr.empty() )
+				u.ktimeout_ms = ktimeout_attr.as_int();
+			u.name = !name_attr.empty() ? name_attr.value() : u.device;
+			cfg_units.push_back(u);
+		}
+
+		units = cfg_units;
 	}
 
-	if ( rc == 0 )
-		return -1;		// Indicate timeout
+	//////////////////////////////////////////////////////////////
+	// The programmer's buffer and type codes, from which segments
+	// are planned for EPROM types that do not list them
+	//////////////////////////////////////////////////////////////
 
-	do	{
-		rc = read(serial,&ch,1);
-	} while ( rc == -1 && errno == EINTR );
+	if ( prompro_node.child("programmer") ) {
+		pugi::xml_node prog_node = prompro_node.child("programmer");
+		s_programmer prog;
 
-	assert(rc == 1);
+		prog.buffer = prog_node.attribute("buffer").as_uint(prog.buffer);
+		for ( pugi::xml_node type_node = prog_node.child("type"); type_node; type_node = type_node.next_sibling("type") ) {
+			s_typecode code;
 
-	if ( cmd_debug ) {
-		if ( isprint(ch) ) {
-			fprintf(stderr," <= '%c'\n",ch);
-		} else	{
-			fprintf(stderr," <= 0x%02X\n",ch);
+			code.ppname = type_node.attribute("use").value();
+			code.title = type_node.attribute("title").value();
+			code.part = type_node.attribute("part").as_uint();
+			code.offset = type_node.attribute("offset").as_uint();
+			code.size = type_node.attribute("size").as_uint();
+			prog.codes.push_back(code);
 		}
+
+		programmer = prog;
 	}
 
-	return int(ch);
-}
+	{
+		pugi::xml_node eproms_node = prompro_node.child("eproms");
 
-static void
-writech(const char *data) {
-	int n = strlen(data);
-	int rc;
-
-	do	{
-		rc = write(serial,data,n);
-	} while ( rc == -1 && errno == EINTR );
-	
-	if ( cmd_debug && n > 0 ) {
-		for ( int x=0; x<n; ++x ) {
-			char ch = data[x];
-
-			if ( isprint(ch) ) {
-				fprintf(stderr," => '%c'\n",ch);
-			} else	{
-				fprintf(stderr," => 0x%02X\n",ch);
+		for ( auto it=eproms_node.begin(); it != eproms_node.end(); ++it ) {
+			pugi::xml_node eprom_node = *it;
+			s_eprom_type etype;
+
+			etype.name = eprom_node.attribute("type").value();
+			etype.segsize = eprom_node.attribute("segsize").as_uint();
+			etype.size = eprom_node.attribute("size").as_uint();
+
+			for ( auto i2=eprom_node.begin(); i2 != eprom_node.end(); ++ i2 ) {
+				pugi::xml_node seg_node = *i2;
+				s_segment eseg;
+
+				eseg.ppname = seg_node.attribute("use").value();
+				eseg.offset = seg_node.attribute("offset").as_uint();
+				eseg.base = eseg.offset;
+				eseg.title = seg_node.attribute("title").value();
+				etype.segs.push_back(eseg);
 			}
+
+			eproms[etype.name] = etype;
 		}
 	}
 
-	assert(rc == rc);
+	{
+		pugi::xml_node dflts_node = prompro_node.child("defaults");
+		pugi::xml_attribute eprom_type_attr = dflts_node.attribute("eprom");
+
+		if ( !eprom_type_attr.empty() )
+			eprom_type = eprom_type_attr.value();
+	}
+
+	xml_loaded = true;
 }
 
 static void
-writecr() {
-	writech("\r");
+usage() {
+
+	fputs(	"Usage: prompro [-d file] [-f fmt] [-x dump] [-V image [-A]] [-B]\n"
+		"\t\t[--range start:len] [--fingerprint [--samples NxW] [--known dir]]\n"
+		"\t\t[--cache dir [--confidence N]] [--reads N [--agree K] [--weak]]\n"
+		"\t\t[--retries N] [--resume] [--batch file | --tray N] [--gang]\n"
+		"\t\t[--archive dir [--import file... | --seen file | --extract sha256]]\n"
+		"\t\t[--diff image image]\n"
+		"\t\t[-e eprom_type] [-u unit] [-K ms] [-M] [-P] [-h]\n"
+		"where:\n"
+		"\t-d file\t\tDownload EPROM to file (CRC32/SHA-256 in file.digest)\n"
+		"\t-f fmt\t\tOutput format: text, bin, ihex, srec or ppz (default:\n"
+		"\t\t\tby extension .bin/.rom, .hex/.ihx, .s19/.srec/.mot,\n"
+		"\t\t\t.ppz, else the raw upload text). A .ppz file holds the\n"
+		"\t\t\tsegments compressed, each readable on its own\n"
+		"\t-x dump\t\tConvert archived upload text (or a .ppz image) to\n"
+		"\t\t\t-d file, no device\n"
+		"\t-V image\tVerify EPROM against a binary or .ppz image\n"
+		"\t-A\t\tStop verifying at the first difference\n"
+		"\t-B\t\tBlank check (stops at the first programmed byte)\n"
+		"\t--range start:len\n"
+		"\t\t\tRead only these addresses, to -d file (a .bin holds\n"
+		"\t\t\tjust the window) or as a hex dump\n"
+		"\t--fingerprint\tIdentify the chip from sampled windows\n"
+		"\t--samples NxW\tSample N windows of W bytes (default 16x64)\n"
+		"\t--known dir\tMatch the fingerprint against binary images in dir\n"
+		"\t--cache dir\tCache -d images; a reinserted chip is served from it\n"
+		"\t--confidence N\tExtra windows to confirm a cache hit (default 16)\n"
+		"\t--reads N\tRead each segment up to N times and majority vote\n"
+		"\t\t\tthe -d image (unstable bits to file.unstable)\n"
+		"\t--agree K\tStop once K reads in a row agree (default 2, 0 never)\n"
+		"\t--weak\t\tWeak bit report (file.weak) and heat map (file.heat)\n"
+		"\t--retries N\tRe-read a segment failing validation up to N times\n"
+		"\t\t\t(default 2)\n"
+		"\t--resume\tContinue an interrupted -d download from its journal\n"
+		"\t\t\t(file.journal, file.part), if the chip matches\n"
+		"\t--batch file\tRead the chips listed in file (lines of: eprom_type\n"
+		"\t\t\toutput_file) in one session, ordered to save type\n"
+		"\t\t\tswitches and loads\n"
+		"\t--tray N\tRead N chips of the -e type in one session, to -d\n"
+		"\t\t\tfiles numbered from 1 (file-001.bin, or a %03u in\n"
+		"\t\t\tthe name)\n"
+		"\t--gang\t\tRead the --batch or --tray chips on all the configured\n"
+		"\t\t\tunits at once\n"
+		"\t--archive dir\tStore each clean -d image in a deduplicated archive\n"
+		"\t--import\tImport the image files named after the options\n"
+		"\t\t\t(.bin, .hex, .ppz or -d text) into the --archive, no device\n"
+		"\t--seen file\tTell if the image in file is in the --archive\n"
+		"\t\t\t(exit 0 if so, else 1)\n"
+		"\t--extract sha256\n"
+		"\t\t\tRebuild an archived image to -d file\n"
+		"\t--diff\t\tCompare the two binary or .ppz images named after\n"
+		"\t\t\tthe options, no device (exit 0 if the same)\n"
+		"\t-e eprom_type\tSpecify configured eprom type (or a 27 series part,\n"
+		"\t\t\tplanned from the <programmer> type codes)\n"
+		"\t-u unit\t\tUse the named (or numbered) <serial> unit\n"
+		"\t-K ms\t\tIdle keepalive interval (0 disables)\n"
+		"\t-M\t\tReport wire efficiency per command\n"
+		"\t-P\t\tReport host cost per job phase (perf counters)\n"
+		"\t-v\t\tVerbose messages\n"
+		"\t-D\t\tEnable debugging output\n"
+		"\t-h\t\tThis info\n",
+		stdout);
+	exit(0);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Parse --range start:len (C style numbers: 0x100:256)
+//////////////////////////////////////////////////////////////////////
+
 static void
-timeout(const char *message) {
-	fputs("TIMEOUT: ",stderr);
-	fputs(message,stderr);
-	fputs("\n",stderr);
-	exit(13);
+parse_range(const char *arg) {
+	const char *spec = arg;
+	char *ep;
+
+	range_start = strtoul(arg,&ep,0);
+	if ( ep != arg && *ep == ':' ) {
+		arg = ep + 1;
+		range_len = strtoul(arg,&ep,0);
+		if ( ep != arg && !*ep && range_len > 0 ) {
+			range = true;
+			return;
+		}
+	}
+	fprintf(stderr,"Invalid --range '%s': expected start:len\n",spec);
+	exit(1);
 }
 
-static bool
-get_prompt(int timeout_ms=0) {
-	char ch;
+//////////////////////////////////////////////////////////////////////
+// Parse the count argument of option opt, which must be lo to hi
+//////////////////////////////////////////////////////////////////////
 
-	if ( timeout_ms <= 0 )
-		timeout_ms = rtimeout_ms;
+static unsigned
+parse_count(const char *opt,const char *arg,unsigned lo,unsigned hi) {
+	char *ep;
+	unsigned long n;
 
-	do	{
-		ch = readch(timeout_ms);
-		if ( ch == -1 )
-			return false;	// Timeout
-	} while ( ch != '*' );
-	
-	return true;
+	errno = 0;
+	n = strtoul(arg,&ep,0);
+	if ( ep == arg || *ep || errno || *arg == '-' || n < lo || n > hi ) {
+		fprintf(stderr,"Invalid --%s '%s': expected %u to %u\n",opt,arg,lo,hi);
+		exit(1);
+	}
+	return n;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Parse --samples NxW
+//////////////////////////////////////////////////////////////////////
+
 static void
-select_type(const char *type) {
+parse_samples(const char *arg) {
+	char *ep;
 
-	writech("S");
-	writech(type);
-	writecr();
-	if ( !get_prompt(6000) )
-		timeout("Selecting PROMPRO EPROM type");
+	fp_windows = strtoul(arg,&ep,0);
+	if ( fp_windows > 0 && (*ep == 'x' || *ep == 'X') ) {
+		const char *w = ep + 1;
+
+		fp_wsize = strtoul(w,&ep,0);
+		if ( ep != w && !*ep && fp_wsize > 0 )
+			return;
+	}
+	fprintf(stderr,"Invalid --samples '%s': expected NxW\n",arg);
+	exit(1);
 }
 
-#if 0
-static void
-relocate(unsigned addr) {
-	char buf[32];
+//////////////////////////////////////////////////////////////////////
+// Look up an EPROM type. One configured without segments, or not
+// configured at all but named for a 27 series part (27C512 etc.), has
+// its segments planned from the <programmer> type codes on first use.
+// Returns null if the type is unknown.
+//////////////////////////////////////////////////////////////////////
 
-	sprintf(buf,"R%04X\r",addr);
-	writech(buf);
-	if ( !get_prompt(16000) )
-		timeout("Setting Relocation address");
-}
-#endif
+static s_eprom_type *
+find_eprom(const std::string& name) {
+	auto it = eproms.find(name);
 
-static void
-load() {
-	writech("L\r");
-	if ( !get_prompt(16000) )
-		timeout("Loading from EPROM.\n");
+	if ( it == eproms.end() ) {
+		s_eprom_type etype;
+
+		if ( !(etype.size = part_size(name)) )
+			return 0;
+		etype.name = name;
+		it = eproms.insert(std::make_pair(name,etype)).first;
+	}
+
+	s_eprom_type& etype = it->second;
+
+	if ( etype.segs.empty() ) {
+		if ( etype.size == 0 )
+			etype.size = part_size(name);
+		if ( etype.size == 0 ) {
+			fprintf(stderr,"EPROM type '%s' lists no segments, and has no size to plan them for\n",
+				name.c_str());
+			exit(1);
+		}
+		if ( !plan_segments(programmer,etype.size,etype) )
+			exit(1);
+	}
+	return &etype;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Load the --batch job list: lines of "eprom_type output_file", with
+// blank lines and # comments ignored
+//////////////////////////////////////////////////////////////////////
+
 static void
-select_type(const s_segment& seg) {
+load_batch(const char *path,std::vector<s_chipjob>& jobs) {
+	FILE *f = fopen(path,"r");
+	char line[1024];
+	unsigned lno = 0;
 
-	if ( prompro_type != seg.ppname ) {
-		if ( verbose )
-			printf("Selecting PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
-		select_type(seg.ppname.c_str());
-		prompro_type = seg.ppname;
-	} else	{
-		if ( verbose )
-			printf("Continuing to use PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
+	if ( !f ) {
+		fprintf(stderr,"%s: Opening batch file %s\n",strerror(errno),path);
+		exit(2);
+	}
+
+	while ( fgets(line,sizeof line,f) ) {
+		char type[128], out[900];
+		int n;
+
+		++lno;
+		if ( (n = sscanf(line,"%127s %899s",type,out)) < 1 || type[0] == '#' )
+			continue;
+
+		s_eprom_type *etype = n == 2 ? find_eprom(type) : 0;
+
+		if ( !etype ) {
+			fprintf(stderr,"%s line %u: %s\n",
+				path,
+				lno,
+				n != 2 ? "expected: eprom_type output_file" : "unknown EPROM type");
+			exit(1);
+		}
+
+		s_chipjob job;
+
+		job.etype = etype;
+		job.path = out;
+		job.fmt = download_fmt;
+		job.n = jobs.size() + 1;
+		jobs.push_back(job);
+	}
+	fclose(f);
+
+	if ( jobs.empty() ) {
+		fprintf(stderr,"No chips listed in batch file %s\n",path);
+		exit(1);
 	}
 }
 
-static void
-select_type() {
-	
-	if ( eprom->segs.size() < 1 ) {
-		fprintf(stderr,"XML misconfiguration for EPROM type '%s'\n",
-			eprom->name.c_str());
+//////////////////////////////////////////////////////////////////////
+// Output file n of a --tray: a printf style %u (%03u etc.) in pattern
+// is replaced by n, else -NNN goes in front of the extension
+//////////////////////////////////////////////////////////////////////
+
+static std::string
+numbered_path(const std::string& pattern,unsigned n) {
+	size_t pct = pattern.find('%');
+	char buf[32];
+
+	if ( pct == std::string::npos ) {
+		size_t slash = pattern.rfind('/'), dot = pattern.rfind('.');
+
+		if ( dot == std::string::npos || dot == 0 || (slash != std::string::npos && dot < slash + 2) )
+			dot = pattern.size();
+		snprintf(buf,sizeof buf,"-%03u",n);
+		return pattern.substr(0,dot) + buf + pattern.substr(dot);
+	}
+
+	size_t end = pct + 1;
+
+	while ( end < pattern.size() && isdigit(pattern[end]) )
+		++end;
+	if ( end >= pattern.size() || end - pct > 4 || (pattern[end] != 'u' && pattern[end] != 'd')
+	  || pattern.find('%',end) != std::string::npos ) {
+		fprintf(stderr,"Invalid --tray file name '%s': use one %%u (or %%03u)\n",pattern.c_str());
 		exit(1);
 	}
 
-	s_segment& seg = eprom->segs[0];
-	select_type(seg);
+	std::string conv = pattern.substr(pct,end - pct) + "u";
+
+	snprintf(buf,sizeof buf,conv.c_str(),n);
+	return pattern.substr(0,pct) + buf + pattern.substr(end + 1);
 }
 
+//////////////////////////////////////////////////////////////////////
+// The chips of a --batch file, or of a --tray
+//////////////////////////////////////////////////////////////////////
+
 static void
-download_file(const char *path) {
-	FILE *dfile = fopen(path,"w");
+batch_jobs(std::vector<s_chipjob>& jobs) {
 
-	if ( !dfile ) {
-		fprintf(stderr,"%s: Opening file %s for write.\n",
-			strerror(errno),
-			path);
-		exit(2);
-	}
+	if ( batch_file != "" )
+		load_batch(batch_file.c_str(),jobs);
 
-	if ( verbose )
-		printf("Downloading EPROM to file '%s'\n",
-			download.c_str());
+	for ( unsigned n = 1; n <= tray; ++n ) {
+		s_chipjob job;
 
-	for ( auto it = eprom->segs.begin(); it != eprom->segs.end(); ++it ) {
-		const s_segment& seg = *it;
-		unsigned offset = seg.offset;
+		job.etype = eprom;
+		job.path = numbered_path(download,n);
+		job.fmt = download_fmt;
+		job.n = n;
+		jobs.push_back(job);
+	}
+}
 
-		select_type(seg);
-		load();
+//////////////////////////////////////////////////////////////////////
+// Add a clean download to the --archive
+//////////////////////////////////////////////////////////////////////
 
-		int ch;
-		bool df = cmd_debug;
+static void
+archive_chip(const s_eprom_type& etype,const std::vector<unsigned char>& image,const char *path) {
+	s_archived res;
+	s_manifest m;
 
-		cmd_debug = false;
+	if ( !archive_put(archive_dir.c_str(),etype,image,path,res) )
+		return;
+	if ( res.seen && archive_manifest(archive_dir.c_str(),res.sha256,m) )
+		printf("Archived image %s seen before, first from %s\n",res.sha256.c_str(),m.source.c_str());
+	else	printf("Archived image %s: %u of %u chunks new\n",res.sha256.c_str(),res.fresh,res.chunks);
+}
 
-		char cmd[32];
+//////////////////////////////////////////////////////////////////////
+// Seconds the unit has spent in commands that move the chip's data
+//////////////////////////////////////////////////////////////////////
 
-		sprintf(cmd,"U%04X\r",offset);
-		writech(cmd);
+static double
+device_secs(const s_unit& u,unsigned *selects,unsigned *loads) {
+	static const char *cmds[] = { "S", "L", "R", "U" };
+	double secs = 0.0;
+
+	*selects = *loads = 0;
+	for ( unsigned x = 0; x < sizeof cmds / sizeof cmds[0]; ++x ) {
+		auto it = u.wirestats.find(cmds[x]);
+
+		if ( it == u.wirestats.end() )
+			continue;
+		secs += it->second.secs;
+		if ( x == 0 )
+			*selects = it->second.count;
+		else if ( x == 1 )
+			*loads = it->second.count;
+	}
+	return secs;
+}
 
-		do	{
-			ch = readch(5000);
-			fputc(ch,dfile);
-			putchar(ch);
-		} while ( ch != '*' );
+static void
+show_plan(const char *what,const s_plancost& cost) {
+
+	printf("  %-10s %3u type switches, %3u loads, %7lu bytes: %8.1f secs\n",
+		what,
+		cost.selects,
+		cost.loads,
+		cost.bytes,
+		cost.secs);
+}
 
-		fputc('\n',dfile);
-		fflush(dfile);
+//////////////////////////////////////////////////////////////////////
+// A chip read, being written out on the writer thread. Its messages
+// go to msg (a memory stream), printed once the thread is joined.
+//////////////////////////////////////////////////////////////////////
 
-		cmd_debug = df;
+struct s_pending {
+	const s_chipjob	*job;
+	s_chipimage	chip;
+	FILE		*msg;
+	char		*report;
+	size_t		rlen;
+};
 
-		offset += eprom->segsize;
-	}
+static void
+save_pending(s_pending *p) {
 
-	fclose(dfile);
+	save_chip(*p->job->etype,p->chip,p->job->path.c_str(),p->job->fmt,p->msg);
+	fclose(p->msg);
 }
 
 static void
-load_xml(const char *pathname) {
-	pugi::xml_document doc;
-	pugi::xml_parse_result res;
+join_writer(std::thread& writer,s_pending& p) {
 
-	res = doc.load_file(pathname);
-	if ( !res ) {
-		fprintf(stderr,"ERROR %s: at file offset %ld of file %s\n",
-			res.description(),
-			res.offset,
-			pathname);
+	if ( !writer.joinable() )
 		return;
-	}
+	writer.join();
+	fputs(p.report,stdout);
+	free(p.report);
+	p.report = 0;
+}
 
-	pugi::xml_node prompro_node = doc.child("prompro");
+//////////////////////////////////////////////////////////////////////
+// Read every chip of a batch on one unit, in the scheduled order,
+// then compare what the schedule saved with the listed order. Chip N
+// is written out and hashed on a writer thread while the operator
+// swaps in chip N+1. Entering q (or the end of input) stops early.
+//////////////////////////////////////////////////////////////////////
 
-	{
-		pugi::xml_node serial_node = prompro_node.child("serial");
-		pugi::xml_attribute baud_attr = serial_node.attribute("baud");
-		pugi::xml_attribute device_attr = serial_node.attribute("device");
-		pugi::xml_attribute rtscts_attr = serial_node.attribute("rtscts");
+static int
+run_batch(s_unit& unit,std::vector<s_chipjob>& jobs) {
+	std::vector<s_chipjob> listed(jobs);
+	std::string selected = unit.prompro_type;
+	s_costmodel nominal, measured;
+	s_plancost naive, planned, naive_m;
+	unsigned s0, l0, s1, l1, n = 0;
+	int rc = 0;
+
+	cost_nominal(unit,nominal);
+	plan_listed(listed);
+	plan_cost(listed,selected,nominal,naive);
+	schedule(jobs,selected);
+	plan_cost(jobs,selected,nominal,planned);
+
+	printf("Batch of %u chips (predicted at %.0f secs per S, %.0f per L, %u baud):\n",
+		unsigned(jobs.size()),
+		nominal.select,
+		nominal.load,
+		unit.baud_rate);
+	show_plan("As listed",naive);
+	show_plan("Scheduled",planned);
+	printf("  Predicted saving: %.1f secs\n",naive.secs - planned.secs);
+
+	double t0 = device_secs(unit,&s0,&l0);
+	s_pending slot[2];
+	std::thread writer;
+	unsigned cur = 0, nread = 0;
+
+	for ( auto it = jobs.begin(); it != jobs.end(); ++it ) {
+		std::string reply;
+		char prompt[1200];
+
+		select_type_start(unit,*it->etype,it->order[0]);
+
+		snprintf(prompt,sizeof prompt,
+			"Place EPROM %u of %u (%s, to %s) in socket, and press CR when ready (q to stop):",
+			++n,
+			unsigned(jobs.size()),
+			it->etype->name.c_str(),
+			it->path.c_str());
+
+		int orc = operator_wait(prompt,reply,&unit);
+
+		join_writer(writer,slot[cur ^ 1]);
+
+		if ( orc < 0 || !unit.healthy ) {
+			fprintf(stderr,"PROMPRO-8 %s stopped responding: batch abandoned at chip %u.\n",
+				unit.name.c_str(),
+				n);
+			return 13;
+		}
+		if ( orc == 0 || reply == "q" ) {
+			printf("Batch stopped after %u of %u chips.\n",n - 1,unsigned(jobs.size()));
+			break;
+		}
+
+		s_pending& p = slot[cur];
 
-		if ( !baud_attr.empty() )
-			baud_rate = baud_attr.as_uint();
-		if ( !device_attr.empty() )
-			device = device_attr.value();
-		if ( !rtscts_attr.empty() )
-			rtscts = !!rtscts_attr.as_int();
+		if ( !read_chip(unit,*it->etype,it->path.c_str(),it->fmt,&it->order,p.chip) )
+			rc = 3;
+		++nread;
+		p.job = &*it;
+		p.report = 0;
+		if ( !(p.msg = open_memstream(&p.report,&p.rlen)) ) {
+			fprintf(stderr,"%s: open_memstream()\n",strerror(errno));
+			exit(3);
+		}
+		writer = std::thread(save_pending,&p);
+		cur ^= 1;
 	}
+	join_writer(writer,slot[cur ^ 1]);
 
-	{
-		pugi::xml_node eproms_node = prompro_node.child("eproms");
-		
-		for ( auto it=eproms_node.begin(); it != eproms_node.end(); ++it ) {
-			pugi::xml_node eprom_node = *it;
-			s_eprom_type etype;
+	double secs = device_secs(unit,&s1,&l1) - t0;
+	std::vector<s_chipjob> read;		// Chips read, in listed order
 
-			etype.name = eprom_node.attribute("type").value();
-			etype.segsize = eprom_node.attribute("segsize").as_uint();
+	for ( auto lt = listed.begin(); lt != listed.end(); ++lt )
+		for ( unsigned j = 0; j < nread; ++j )
+			if ( jobs[j].path == lt->path ) {
+				read.push_back(*lt);
+				break;
+			}
 
-			for ( auto i2=eprom_node.begin(); i2 != eprom_node.end(); ++ i2 ) {
-				pugi::xml_node seg_node = *i2;
-				s_segment eseg;
+	cost_measured(unit,measured);
+	plan_cost(read,selected,measured,naive_m);
+
+	printf("\nBatch done: %u chips, %u type switches, %u loads in %.1f device secs\n",
+		nread,
+		s1 - s0,
+		l1 - l0,
+		secs);
+	printf("  As listed would take %.1f secs at the measured rates (%.1f per S, %.1f per L):"
+		" %.1f secs saved\n",
+		naive_m.secs,
+		measured.select,
+		measured.load,
+		naive_m.secs - secs);
+	return rc;
+}
 
-				eseg.ppname = seg_node.attribute("use").value();
-				eseg.offset = seg_node.attribute("offset").as_uint();
-				etype.segs.push_back(eseg);
-			}
+//////////////////////////////////////////////////////////////////////
+// Read a batch on every configured unit that answers, each driven by
+// its own worker thread (see gang.hpp). This thread is the operator's:
+// it puts the units' requests for chips to the operator one at a time.
+// Entering q (or the end of input) stops the batch once the chips in
+// the sockets are read.
+//////////////////////////////////////////////////////////////////////
 
-			eproms[etype.name] = etype;
-		}
+static int
+run_gang(std::vector<s_chipjob>& jobs) {
+	std::vector<s_unit*> ready;
+	unsigned listed = jobs.size();
+	s_gang gang;
+	int rc = 0;
+
+	for ( auto it = units.begin(); it != units.end(); ++it ) {
+		if ( open_unit(*it) )
+			ready.push_back(&*it);
+		else	fprintf(stderr,"Unit %s (%s) left out of the gang.\n",it->name.c_str(),it->device.c_str());
+	}
+	if ( ready.empty() ) {
+		fputs("No responding PROMPRO-8 unit.\n",stderr);
+		exit(13);
 	}
 
-	{
-		pugi::xml_node dflts_node = prompro_node.child("defaults");
-		pugi::xml_attribute eprom_type_attr = dflts_node.attribute("eprom");
+	gang.deal(jobs,ready);
 
-		if ( !eprom_type_attr.empty() )
-			eprom_type = eprom_type_attr.value();
-	}
+	printf("Gang of %u units for %u chips:",unsigned(ready.size()),listed);
+	for ( auto it = gang.workers.begin(); it != gang.workers.end(); ++it )
+		printf(" %s %u,",it->unit->name.c_str(),unsigned(it->jobs.size()));
+	puts(" idle units take chips from busy ones");
 
-	xml_loaded = true;
-}
+	const char *phase = perf_phase("gang");
+	unsigned w;
+	s_chipjob job;
 
-static void
-usage() {
-	
-	fputs(	"Usage: prompro [-d file] [-e eprom_type] [-h]\n"
-		"where:\n"
-		"\t-d file\t\tDownload EPROM to file\n"
-		"\t-e eprom_type\tSpecify configured eprom type\n"
-		"\t-v\t\tVerbose messages\n"
-		"\t-D\t\tEnable debugging output\n"
-		"\t-h\t\tThis info\n",
-		stdout);
-	exit(0);
-}
+	gang.start();
+	while ( gang.next_ask(w,job) ) {
+		std::string reply;
+		char prompt[1200];
 
-int
-main(int argc,char **argv) {
-	std::string xml_path = getenv("HOME");
-	int optch;
+		snprintf(prompt,sizeof prompt,
+			"Unit %s: place EPROM %u of %u (%s, to %s) in its socket, and press CR when ready (q to stop):",
+			gang.workers[w].unit->name.c_str(),
+			job.n,
+			listed,
+			job.etype->name.c_str(),
+			job.path.c_str());
 
-	//////////////////////////////////////////////////////////////
-	// Load from XML config file(s) for defaults
-	//////////////////////////////////////////////////////////////
+		bool go = operator_wait(prompt,reply) > 0 && reply != "q";
 
-	xml_path += "/.prompro.xml";
+		if ( !go )
+			puts("Gang stopping: the chips being read are finished first.");
+		gang.answer(w,go);
+	}
+	gang.join();
+	perf_phase(phase);
 
-	if ( !access(xml_path.c_str(),F_OK) )
-		load_xml(xml_path.c_str());
+	gang.report(listed);
 
-	if ( !access(".prompro.xml",F_OK) )
-		load_xml("./.prompro.xml");
+	for ( auto it = gang.workers.begin(); it != gang.workers.end(); ++it ) {
+		s_unit& u = *it->unit;
 
-	if ( !xml_loaded ) {
-		fprintf(stderr,"Missing or invalid ~/.prompro.xml and/or ./.prompro.xml files.\n");
-		exit(1);
+		if ( it->failed > 0 )
+			rc = 3;
+		close(u.fd);
+		u.fd = -1;
+		if ( show_metrics )
+			report_wirestats(u);
 	}
+	return rc;
+}
 
-	if ( cmd_debug )
-		printf("Dev='%s', baud=%u, rtscts=%d, eprom=%s\n",
-			device.c_str(),
-			baud_rate,
-			rtscts,
-			eprom_type.c_str());
+enum {
+	OPT_RANGE = 256,			// Long only options
+	OPT_FINGERPRINT,
+	OPT_SAMPLES,
+	OPT_KNOWN,
+	OPT_CACHE,
+	OPT_CONFIDENCE,
+	OPT_READS,
+	OPT_AGREE,
+	OPT_WEAK,
+	OPT_RETRIES,
+	OPT_RESUME,
+	OPT_BATCH,
+	OPT_TRAY,
+	OPT_GANG,
+	OPT_ARCHIVE,
+	OPT_IMPORT,
+	OPT_SEEN,
+	OPT_EXTRACT,
+	OPT_DIFF,
+};
+
+static const struct option long_opts[] = {
+	{ "range",	required_argument,	0,	OPT_RANGE },
+	{ "fingerprint", no_argument,		0,	OPT_FINGERPRINT },
+	{ "samples",	required_argument,	0,	OPT_SAMPLES },
+	{ "known",	required_argument,	0,	OPT_KNOWN },
+	{ "cache",	required_argument,	0,	OPT_CACHE },
+	{ "confidence",	required_argument,	0,	OPT_CONFIDENCE },
+	{ "reads",	required_argument,	0,	OPT_READS },
+	{ "agree",	required_argument,	0,	OPT_AGREE },
+	{ "weak",	no_argument,		0,	OPT_WEAK },
+	{ "retries",	required_argument,	0,	OPT_RETRIES },
+	{ "resume",	no_argument,		0,	OPT_RESUME },
+	{ "batch",	required_argument,	0,	OPT_BATCH },
+	{ "tray",	required_argument,	0,	OPT_TRAY },
+	{ "gang",	no_argument,		0,	OPT_GANG },
+	{ "archive",	required_argument,	0,	OPT_ARCHIVE },
+	{ "import",	no_argument,		0,	OPT_IMPORT },
+	{ "seen",	required_argument,	0,	OPT_SEEN },
+	{ "extract",	required_argument,	0,	OPT_EXTRACT },
+	{ "diff",	no_argument,		0,	OPT_DIFF },
+	{ "help",	no_argument,		0,	'h' },
+	{ 0,		0,			0,	0 }
+};
+
+int
+main(int argc,char **argv) {
+	std::string xml_path = getenv("HOME");
+	int optch;
 
 	//////////////////////////////////////////////////////////////
 	// Process command line arguments
 	//////////////////////////////////////////////////////////////
 
-	while ( (optch = getopt(argc, argv, ":hd:e:Dv")) != -1 ) {
+	while ( (optch = getopt_long(argc,argv,":hd:f:x:V:ABe:u:K:DvMP",long_opts,0)) != -1 ) {
 		switch ( optch ) {
 		case 'd':			// Download EPROM
 			download = optarg;
 			break;
+		case 'f':
+			download_fmt = imgfmt_parse(optarg);
+			if ( download_fmt == FMT_NONE ) {
+				fprintf(stderr,"Unknown output format '%s'\n",optarg);
+				exit(1);
+			}
+			break;
+		case 'x':
+			text_dump = optarg;
+			break;
+		case 'V':
+			verify = optarg;
+			break;
+		case 'A':
+			verify_abort = true;
+			break;
+		case 'B':
+			blank = true;
+			break;
+		case OPT_RANGE:
+			parse_range(optarg);
+			break;
+		case OPT_FINGERPRINT:
+			fingerprint = true;
+			break;
+		case OPT_SAMPLES:
+			parse_samples(optarg);
+			break;
+		case OPT_KNOWN:
+			known_dir = optarg;
+			break;
+		case OPT_CACHE:
+			cache_dir = optarg;
+			break;
+		case OPT_CONFIDENCE:
+			confidence = parse_count("confidence",optarg,0,4096);
+			break;
+		case OPT_READS:
+			reads = parse_count("reads",optarg,1,vote_max_passes);
+			break;
+		case OPT_AGREE:
+			agree = parse_count("agree",optarg,0,vote_max_passes);
+			break;
+		case OPT_WEAK:
+			weak = true;
+			break;
+		case OPT_RETRIES:
+			upload_retries = parse_count("retries",optarg,0,100);
+			break;
+		case OPT_RESUME:
+			resume = true;
+			break;
+		case OPT_BATCH:
+			batch_file = optarg;
+			break;
+		case OPT_TRAY:
+			tray = strtoul(optarg,0,0);
+			if ( tray < 1 ) {
+				fputs("--tray needs a chip count of 1 or more\n",stderr);
+				exit(1);
+			}
+			break;
+		case OPT_GANG:
+			gang = true;
+			break;
+		case OPT_ARCHIVE:
+			archive_dir = optarg;
+			break;
+		case OPT_IMPORT:
+			archive_import_files = true;
+			break;
+		case OPT_SEEN:
+			archive_lookup_file = optarg;
+			break;
+		case OPT_EXTRACT:
+			archive_extract_sha = optarg;
+			break;
+		case OPT_DIFF:
+			diff_files = true;
+			break;
 		case 'e':
-			eprom_type = optarg;
+			opt_eprom_type = optarg;
+			break;
+		case 'u':
+			unit_name = optarg;
+			break;
+		case 'K':
+			keepalive_ms = atoi(optarg);
 			break;
 		case 'D':
 			cmd_debug = true;
@@ -415,6 +994,12 @@ main(int argc,char **argv) {
 		case 'v':
 			verbose = true;
 			break;
+		case 'M':
+			show_metrics = true;
+			break;
+		case 'P':
+			show_perf = true;
+			break;
 		case 'h':
 			usage();
 			break;
@@ -427,83 +1012,333 @@ main(int argc,char **argv) {
 		}
 	}
 
+	if ( weak && reads < 2 ) {
+		fputs("--weak needs repeated reads: add --reads N\n",stderr);
+		exit(1);
+	}
+
+	if ( batch_file != "" && (download != "" || verify != "" || blank || range || fingerprint || reads > 1 || resume) ) {
+		fputs("--batch reads whole chips to the files it lists: no -d, -V, -B, --range,\n"
+			"--fingerprint, --reads or --resume\n",stderr);
+		exit(1);
+	}
+
+	if ( batch_file != "" && tray > 0 ) {
+		fputs("Use one of --batch and --tray\n",stderr);
+		exit(1);
+	}
+
+	if ( tray > 0 && (download == "" || verify != "" || blank || range || fingerprint || reads > 1 || resume) ) {
+		fputs("--tray reads whole chips to numbered -d files: no -V, -B, --range,\n"
+			"--fingerprint, --reads or --resume\n",stderr);
+		exit(1);
+	}
+	if ( tray > 0 )
+		numbered_path(download,1);	// Check the pattern
+
+	{
+		unsigned offline = archive_import_files + (archive_lookup_file != "") + (archive_extract_sha != "");
+
+		if ( offline > 0 && archive_dir == "" ) {
+			fputs("--import, --seen and --extract work on an --archive dir\n",stderr);
+			exit(1);
+		}
+		if ( offline > 1 || (offline > 0 && (text_dump != "" || batch_file != "" || tray > 0)) ) {
+			fputs("Use one of --import, --seen, --extract, -x, --batch and --tray\n",stderr);
+			exit(1);
+		}
+		if ( archive_extract_sha != "" && download == "" ) {
+			fputs("--extract needs -d to name the output file\n",stderr);
+			exit(1);
+		}
+		if ( archive_import_files && optind >= argc ) {
+			fputs("--import needs image files to import\n",stderr);
+			exit(1);
+		}
+		if ( archive_dir != "" && offline == 0 && (download == "" || range || reads > 1 || batch_file != "" || tray > 0) ) {
+			fputs("--archive stores whole chip -d downloads (no --range, --reads, --batch\n"
+				"or --tray: --import their files afterwards)\n",stderr);
+			exit(1);
+		}
+	}
+
+	if ( diff_files && (argc - optind != 2 || text_dump != "" || archive_dir != "" || batch_file != "" || tray > 0) ) {
+		fputs("--diff compares the two image files named after the options\n"
+			"(no -x, --archive, --batch or --tray)\n",stderr);
+		exit(1);
+	}
+
+	if ( gang && ((batch_file == "" && tray == 0) || unit_name != "" || cmd_debug) ) {
+		fputs("--gang reads a --batch or --tray on every unit: no -u or -D\n",stderr);
+		exit(1);
+	}
+
+	if ( resume && (download == "" || range || reads > 1) ) {
+		fputs("--resume continues a whole chip -d download (no --range or --reads)\n",stderr);
+		exit(1);
+	}
+
+	//////////////////////////////////////////////////////////////
+	// Load from XML config file(s) for defaults
+	//////////////////////////////////////////////////////////////
+
+	if ( show_perf )
+		perf_open();
+
+	const char *phase = perf_phase("config");
+
+	xml_path += "/.prompro.xml";
+
+	if ( !access(xml_path.c_str(),F_OK) )
+		load_xml(xml_path.c_str());
+
+	if ( !access(".prompro.xml",F_OK) )
+		load_xml("./.prompro.xml");
+
+	if ( !xml_loaded ) {
+		fprintf(stderr,"Missing or invalid ~/.prompro.xml and/or ./.prompro.xml files.\n");
+		exit(1);
+	}
+
+	if ( opt_eprom_type != "" )
+		eprom_type = opt_eprom_type;	// -e overrides the config default
+
+	if ( cmd_debug ) {
+		for ( auto it = units.begin(); it != units.end(); ++it )
+			printf("Unit '%s': Dev='%s', baud=%u, rtscts=%d\n",
+				it->name.c_str(),
+				it->device.c_str(),
+				it->baud_rate,
+				it->rtscts);
+		printf("eprom=%s\n",eprom_type.c_str());
+	}
+
+	perf_phase(phase);
+
 	//////////////////////////////////////////////////////////////
 	// Check that the eprom type is known
 	//////////////////////////////////////////////////////////////
 
 	{
-		auto it = eproms.find(eprom_type);
-		if ( it == eproms.end() ) {
+		eprom = find_eprom(eprom_type);
+		if ( !eprom ) {
 			fprintf(stderr,"Unknown EPROM type '%s'\n",eprom_type.c_str());
 			exit(1);
 		}
 
-		eprom = &it->second;		
 		if ( verbose )
 			printf("EPROM Type: %s\n",eprom->name.c_str());
+
+		unsigned size = image_size(*eprom);
+
+		if ( range && (range_start >= size || range_len > size - range_start) ) {
+			fprintf(stderr,"Range 0x%04X:0x%X is outside the %u byte %s\n",
+				range_start,
+				range_len,
+				size,
+				eprom->name.c_str());
+			exit(1);
+		}
 	}
 
 	//////////////////////////////////////////////////////////////
-	// Open the serial device
+	// Offline conversion of an archived text dump
 	//////////////////////////////////////////////////////////////
 
-	serial = open(device.c_str(),O_RDWR,0);
-	if ( serial == -1 ) {
-		fprintf(stderr,"%s: Unable to open serial device %s\n",
-			strerror(errno),
-			device.c_str());
-		exit(2);
+	if ( text_dump != "" ) {
+		if ( download == "" ) {
+			fputs("-x requires -d to name the output file\n",stderr);
+			exit(1);
+		}
+		convert_dump(text_dump.c_str(),*eprom,download.c_str(),download_fmt);
+		return 0;
 	}
 
-	if ( tcgetattr(serial,&term) < 0 ) {
-		fprintf(stderr,"%s: getting serial port attributes of %s\n",
-			strerror(errno),
-			device.c_str());
-		exit(2);
+	if ( diff_files )
+		return diff_images(*eprom,argv[optind],argv[optind + 1]);
+
+	//////////////////////////////////////////////////////////////
+	// Offline work on the dump archive
+	//////////////////////////////////////////////////////////////
+
+	if ( archive_import_files ) {
+		std::vector<std::string> files(argv + optind,argv + argc);
+
+		return archive_import(archive_dir.c_str(),*eprom,files);
+	}
+
+	if ( archive_lookup_file != "" )
+		return archive_lookup(archive_dir.c_str(),*eprom,archive_lookup_file.c_str());
+
+	if ( archive_extract_sha != "" ) {
+		std::vector<unsigned char> image;
+		s_manifest m;
+		s_eprom_type *etype;
+
+		if ( !archive_get(archive_dir.c_str(),archive_extract_sha,m,image) ) {
+			fprintf(stderr,"Image %s is not in archive %s\n",archive_extract_sha.c_str(),archive_dir.c_str());
+			return 1;
+		}
+		if ( !(etype = find_eprom(m.etype)) || image_size(*etype) != image.size() ) {
+			fprintf(stderr,"Archived image %s is of EPROM type %s, not configured here\n",
+				archive_extract_sha.c_str(),
+				m.etype.c_str());
+			return 1;
+		}
+		if ( !write_image(*etype,image.data(),download.c_str(),download_fmt) ) {
+			fputs("The text format needs the raw upload: use -f bin, ihex, srec or ppz\n",stderr);
+			return 1;
+		}
+		return 0;
 	}
 
-	tcflush(serial,TCIOFLUSH);		// Flush all in/out chars in transit
-	cfmakeraw(&term);			// Setup for raw I/O
-	cfsetspeed(&term,baud_rate);		// Set baud rate
-	term.c_cflag |= PARODD | PARENB;	// Set odd parity
-	if ( rtscts ) {
-		term.c_cflag |= CRTSCTS;	// Enable RTS/CTS flow control
-	} else	{
-		term.c_cflag &= ~CRTSCTS;	// Disable RTS/CTS flow control
+	//////////////////////////////////////////////////////////////
+	// Locate the programmer unit to use
+	//////////////////////////////////////////////////////////////
+
+	s_unit *unit = 0;
+
+	for ( size_t x=0; x<units.size() && !unit; ++x ) {
+		if ( unit_name == "" || units[x].name == unit_name
+		  || unit_name == std::to_string(x) )
+			unit = &units[x];
 	}
 
-	if ( tcsetattr(serial,TCSANOW,&term) < 0 ) { // Apply changes to serial port
-		fprintf(stderr,"%s: Setting serial port attributes of %s\n",
-			strerror(errno),
-			device.c_str());
+	if ( !unit ) {
+		if ( units.empty() )
+			fprintf(stderr,"No <serial> device configured.\n");
+		else	fprintf(stderr,"Unknown unit '%s'\n",unit_name.c_str());
+		exit(1);
 	}
 
-	writech("\r");
+	if ( keepalive_ms >= 0 )
+		for ( auto it = units.begin(); it != units.end(); ++it )
+			it->keepalive_ms = keepalive_ms;
+
+	if ( gang ) {
+		std::vector<s_chipjob> jobs;
 
-	if ( !get_prompt() ) {
-		fputs("PROMPRO-8 is not ready.\n",stderr);
-		exit(4);
+		batch_jobs(jobs);
+		return run_gang(jobs);
 	}
 
 	//////////////////////////////////////////////////////////////
-	// Select EPROM type
+	// Open the serial device
 	//////////////////////////////////////////////////////////////
 
-	select_type();
+	if ( !open_unit(*unit) )
+		exit(unit->fd == -1 ? 2 : 4);
+
+	if ( batch_file != "" || tray > 0 ) {
+		std::vector<s_chipjob> jobs;
+
+		batch_jobs(jobs);
+
+		int rc = run_batch(*unit,jobs);
 
-	puts("Place EPROM in socket, and press CR when ready:");
-	anykey();
+		command_finish(*unit);
+		close(unit->fd);
+		unit->fd = -1;
+
+		if ( show_metrics )
+			report_wirestats(*unit);
+		return rc;
+	}
 
 	//////////////////////////////////////////////////////////////
-	// Check for downloads
+	// Select EPROM type (completes while the operator works). If
+	// the unit dies before the chip goes in, move the job to the
+	// next configured unit that answers.
 	//////////////////////////////////////////////////////////////
 
-	if ( download != "" )
-		download_file(download.c_str());
+	for (;;) {
+		std::string reply;
+		char prompt[256];
+
+		select_type_start(*unit,*eprom);
+
+		snprintf(prompt,sizeof prompt,
+			"Place EPROM in socket%s%s, and press CR when ready:",
+			units.size() > 1 ? " of " : "",
+			units.size() > 1 ? unit->name.c_str() : "");
 
-	close(serial);
+		if ( operator_wait(prompt,reply,unit) >= 0 && unit->healthy )
+			break;
+
+		fprintf(stderr,"PROMPRO-8 %s stopped responding: do not use it.\n",unit->name.c_str());
+		if ( unit->fd >= 0 ) {
+			close(unit->fd);
+			unit->fd = -1;
+		}
 
-	return 0;
+		s_unit *next = 0;
+
+		for ( auto it = units.begin(); it != units.end() && !next; ++it ) {
+			if ( &*it == unit || it->fd >= 0 || !it->healthy )
+				continue;
+			if ( open_unit(*it) )
+				next = &*it;
+		}
+
+		if ( !next ) {
+			fputs("No responding PROMPRO-8 unit remains.\n",stderr);
+			exit(13);
+		}
+
+		unit = next;
+		printf("Job moved to unit %s (%s).\n",unit->name.c_str(),unit->device.c_str());
+	}
+
+	//////////////////////////////////////////////////////////////
+	// Blank check, download and verify, as requested
+	//////////////////////////////////////////////////////////////
+
+	int rc = 0;
+
+	if ( fingerprint )
+		rc = fingerprint_chip(*unit,*eprom,fp_windows,fp_wsize,
+			known_dir != "" ? known_dir.c_str() : 0);
+
+	if ( rc == 0 && blank )
+		rc = blank_check(*unit,*eprom);
+
+	if ( rc == 0 && range )
+		download_range(*unit,*eprom,range_start,range_len,
+			download != "" ? download.c_str() : 0,download_fmt);
+	else if ( rc == 0 && download != "" ) {
+		if ( reads > 1 ) {
+			download_voted(*unit,*eprom,download.c_str(),download_fmt,reads,agree,weak);
+		} else if ( cache_dir == "" ) {
+			std::vector<unsigned char> image;
+
+			if ( !download_file(*unit,*eprom,download.c_str(),download_fmt,archive_dir != "" ? &image : 0,resume) )
+				rc = 3;
+			else if ( archive_dir != "" )
+				archive_chip(*eprom,image,download.c_str());
+		} else if ( !cache_download(*unit,*eprom,cache_dir.c_str(),fp_windows,fp_wsize,confidence,download.c_str(),download_fmt) ) {
+			std::vector<unsigned char> image;
+
+			if ( !download_file(*unit,*eprom,download.c_str(),download_fmt,&image,resume) )
+				rc = 3;
+			else if ( !image.empty() ) {
+				cache_store(*eprom,cache_dir.c_str(),fp_windows,fp_wsize,image);
+				if ( archive_dir != "" )
+					archive_chip(*eprom,image,download.c_str());
+			}
+		}
+	}
+
+	if ( rc == 0 && verify != "" )
+		rc = verify_image(*unit,*eprom,verify.c_str(),verify_abort);
+
+	command_finish(*unit);
+	close(unit->fd);
+	unit->fd = -1;
+
+	if ( show_metrics )
+		report_wirestats(*unit);
+
+	return rc;
 }
 
 // End prompro.cpp
@@ -0,0 +1,183 @@
+///////////////////////////////////////////////////////////////////////
+// prompro.hpp -- Shared declarations for the Prompro-8 tool
+// Date: Sun Feb  8 16:34:07 2015  (C) Warren W. Gay VE3WWG
+///////////////////////////////////////////////////////////////////////
+
+#ifndef PROMPRO_HPP
+#define PROMPRO_HPP
+
+#include <termios.h>
+
+#include "imgfmt.hpp"
+
+#include <string>
+#include <map>
+#include <vector>
+
+extern bool cmd_debug;				// When true, show serial trafic for debugging
+extern bool verbose;				// Verbose messages when true
+extern int rtimeout_ms;				// Read timeout in ms
+
+struct s_segment {
+	std::string	ppname;			// Prompro name
+	unsigned	offset;			// Byte offset
+	std::string	title;			// As shown on PROMPRO-8
+	unsigned	base;			// Chip address of the buffer start once
+						// loaded (the R address; offset, unless
+						// segments share a load)
+
+	s_segment() : offset(0), base(0) {}
+};
+
+struct s_eprom_type {
+	std::string		name;		// Config name for this EPROM
+	unsigned		segsize;	// Segment size
+	std::vector<s_segment>	segs;		// Segment description
+	unsigned		size;		// Part size, when segs are planned
+
+	s_eprom_type() : segsize(0), size(0) {}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Wire efficiency statistics, kept per PROMPRO command
+//////////////////////////////////////////////////////////////////////
+
+struct s_wirestat {
+	unsigned long	count;		// Times command was issued
+	unsigned long	tx;		// Bytes sent to the PROMPRO
+	unsigned long	rx;		// Bytes received (all categories)
+	unsigned long	rx_hex;		// Received hex digits (data + record fields)
+	unsigned long	rx_fmt;		// Received CR/LF/space/record marks
+	unsigned long	rx_prompt;	// Received '*' prompts
+	unsigned long	rx_other;	// Received echo and other text
+	unsigned long	payload;	// EPROM content bytes carried
+	unsigned long	syscalls;	// poll/read/write calls made
+	unsigned long	retries;	// Times reissued after a bad reply
+	double		secs;		// Elapsed seconds in command
+};
+
+//////////////////////////////////////////////////////////////////////
+// One attached PROMPRO-8 programmer (a <serial> config entry)
+//////////////////////////////////////////////////////////////////////
+
+struct s_unit {
+	std::string	name;		// Unit name (defaults to its device)
+	std::string	device;		// Serial device path
+	unsigned	baud_rate;
+	bool		rtscts;
+	int		fd;		// Open serial fd, else -1
+	struct termios	term;
+	std::string	prompro_type;	// Current prompro-8 EPROM type
+	bool		healthy;	// False once the unit stops responding
+	int		keepalive_ms;	// Idle keepalive interval (0 = off)
+	int		ktimeout_ms;	// Keepalive reply timeout
+	double		last_io;	// Monotonic time of last byte received
+	bool		echo;		// Echo uploads to stdout
+	bool		owned;		// Driven by a gang worker thread (not
+					// serviced by the operator loop)
+	bool		quiet;		// Suppress the -D trace (uploads)
+
+	// Asynchronous command (issued without waiting for its prompt):
+	bool		busy;		// Awaiting the '*' prompt
+	std::string	busy_what;	// What is pending, for messages
+	std::string	busy_type;	// Type being selected, if an S command
+	double		deadline;	// Monotonic time the prompt is due by
+
+	std::map<std::string,s_wirestat> wirestats;
+	s_wirestat	*wire;		// Stats for command in progress
+	s_wirestat	discard;	// Bytes outside any command
+	double		wire_t0;	// Start time of command in progress
+
+	s_unit() : baud_rate(0), rtscts(false), fd(-1), healthy(true),
+		keepalive_ms(500), ktimeout_ms(500), last_io(0.0), echo(true), owned(false),
+		quiet(false), busy(false), deadline(0.0), wire(0), discard(), wire_t0(0.0) {}
+};
+
+// unit.cpp
+
+double now_secs();
+void wire_begin(s_unit& u,const char *cmd);
+void wire_end(s_unit& u);
+unsigned bits_per_char();
+void report_wirestats(const s_unit& u);
+
+int readch(s_unit& u,int timeout);
+void writech(s_unit& u,const char *data);
+void writecr(s_unit& u);
+void timeout(s_unit& u,const char *message);
+bool get_prompt(s_unit& u,int timeout_ms=0);
+
+void command_start(s_unit& u,const char *wirename,const char *cmd,int timeout_ms,const char *what);
+void command_done(s_unit& u,bool ok);
+bool command_finish(s_unit& u);
+bool service_unit(s_unit& u);
+void keepalive(s_unit& u,double now);
+
+// These return false only when an owned unit stops answering (see timeout())
+bool select_type(s_unit& u,const s_segment& seg);
+bool select_type_start(s_unit& u,const s_eprom_type& etype,unsigned first=0);
+bool relocate(s_unit& u,unsigned addr);
+bool load(s_unit& u);
+bool open_unit(s_unit& u);
+bool abort_upload(s_unit& u);
+
+// download.cpp
+
+extern unsigned upload_retries;			// Re-reads of a segment that fails validation
+
+struct s_updecoder;
+
+//////////////////////////////////////////////////////////////////////
+// Watches an upload in progress: progress() is called at the end of
+// each line received, and returning false aborts the upload.
+//////////////////////////////////////////////////////////////////////
+
+struct s_upwatch {
+	virtual ~s_upwatch() {}
+	virtual bool progress(const s_segment& seg,const s_updecoder& dec) = 0;
+};
+
+unsigned image_size(const s_eprom_type& etype);
+bool upload_segment(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,s_updecoder& dec,std::string *text,s_upwatch *watch=0,unsigned skip=0);
+bool upload_buffer(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,s_updecoder& dec,std::string *text,s_upwatch *watch=0,unsigned skip=0);
+bool download_file(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,std::vector<unsigned char> *keep=0,bool resume=false,const std::vector<unsigned> *order=0);
+bool write_image(const s_eprom_type& etype,const unsigned char *image,const char *path,e_imgfmt fmt);
+unsigned read_window(s_unit& u,const s_eprom_type& etype,const s_segment& seg,unsigned char *image,unsigned lo,unsigned hi);
+void download_range(s_unit& u,const s_eprom_type& etype,unsigned start,unsigned len,const char *path,e_imgfmt fmt);
+//////////////////////////////////////////////////////////////////////
+// A chip read into memory, to be written out later
+//////////////////////////////////////////////////////////////////////
+
+struct s_chipimage {
+	std::vector<unsigned char> image;
+	std::vector<std::string> text;	// Upload text, per segment
+	std::vector<unsigned>	order;	// Segments in the order read
+	bool			clean;	// Every segment validated
+};
+
+bool read_chip(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,const std::vector<unsigned> *order,s_chipimage& chip);
+void save_chip(const s_eprom_type& etype,const s_chipimage& chip,const char *path,e_imgfmt fmt,FILE *msg);
+void convert_dump(const char *dump,const s_eprom_type& etype,const char *path,e_imgfmt fmt);
+
+// verify.cpp
+
+int verify_image(s_unit& u,const s_eprom_type& etype,const char *path,bool abort_first);
+int blank_check(s_unit& u,const s_eprom_type& etype);
+int diff_images(const s_eprom_type& etype,const char *path_a,const char *path_b);
+
+// fingerprint.cpp
+
+int fingerprint_chip(s_unit& u,const s_eprom_type& etype,unsigned nwin,unsigned wsize,const char *known);
+
+// fpcache.cpp
+
+bool cache_download(s_unit& u,const s_eprom_type& etype,const char *cache,unsigned nwin,unsigned wsize,unsigned confirm,const char *path,e_imgfmt fmt);
+void cache_store(const s_eprom_type& etype,const char *cache,unsigned nwin,unsigned wsize,const std::vector<unsigned char>& image);
+
+// multiread.cpp
+
+void download_voted(s_unit& u,const s_eprom_type& etype,const char *path,e_imgfmt fmt,unsigned reads,unsigned agree,bool weak);
+
+#endif // PROMPRO_HPP
+
+// End prompro.hpp
@@ -0,0 +1,355 @@
+///////////////////////////////////////////////////////////////////////
+// sched.cpp -- Segment scheduling for batches of chips
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include "sched.hpp"
+
+#include <algorithm>
+#include <map>
+
+static const double nominal_select = 6.0;	// S reply time
+static const double nominal_load = 16.0;	// L reply time
+static const double ihex_chars = 45.0 / 16.0;	// Upload chars per byte
+
+void
+cost_nominal(const s_unit& u,s_costmodel& model) {
+
+	model.select = nominal_select;
+	model.load = nominal_load;
+	model.per_byte = u.baud_rate > 0 ? ihex_chars * bits_per_char() / u.baud_rate : 0.0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Nominal figures stand in for commands not yet seen on the unit
+//////////////////////////////////////////////////////////////////////
+
+void
+cost_measured(const s_unit& u,s_costmodel& model) {
+	auto s = u.wirestats.find("S"), l = u.wirestats.find("L"), up = u.wirestats.find("U");
+
+	cost_nominal(u,model);
+	if ( s != u.wirestats.end() && s->second.count > 0 )
+		model.select = s->second.secs / s->second.count;
+	if ( l != u.wirestats.end() && l->second.count > 0 )
+		model.load = l->second.secs / l->second.count;
+	if ( up != u.wirestats.end() && up->second.payload > 0 )
+		model.per_byte = up->second.secs / up->second.payload;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Each chip's segments in their configured order
+//////////////////////////////////////////////////////////////////////
+
+static void
+listed_order(s_chipjob& job) {
+
+	job.order.clear();
+	for ( unsigned x = 0; x < job.etype->segs.size(); ++x )
+		job.order.push_back(x);
+}
+
+void
+plan_listed(std::vector<s_chipjob>& jobs) {
+
+	for ( auto it = jobs.begin(); it != jobs.end(); ++it )
+		listed_order(*it);
+}
+
+static bool
+has_type(const s_eprom_type& etype,const std::string& ppname) {
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it )
+		if ( it->ppname == ppname )
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Order one chip's segments: grouped by type, starting with first and
+// ending with last (when the chip has them). A text dump is kept in
+// its configured order, since the dump is read back in that order.
+//////////////////////////////////////////////////////////////////////
+
+static void
+chip_order(s_chipjob& job,const std::string& first,const std::string& last) {
+	const s_eprom_type& etype = *job.etype;
+	std::vector<std::string> types;
+
+	e_imgfmt fmt = job.fmt == FMT_NONE ? imgfmt_from_path(job.path.c_str()) : job.fmt;
+
+	if ( fmt == FMT_TEXT ) {
+		listed_order(job);
+		return;
+	}
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		bool seen = false;
+
+		for ( auto tt = types.begin(); tt != types.end() && !seen; ++tt )
+			seen = *tt == it->ppname;
+		if ( !seen && it->ppname != first && it->ppname != last )
+			types.push_back(it->ppname);
+	}
+	if ( has_type(etype,first) )
+		types.insert(types.begin(),first);
+	if ( last != first && has_type(etype,last) )
+		types.push_back(last);
+
+	job.order.clear();
+	for ( auto tt = types.begin(); tt != types.end(); ++tt )
+		for ( unsigned x = 0; x < etype.segs.size(); ++x )
+			if ( etype.segs[x].ppname == *tt )
+				job.order.push_back(x);
+}
+
+static bool
+fixed_order(const s_chipjob& job) {
+	e_imgfmt fmt = job.fmt == FMT_NONE ? imgfmt_from_path(job.path.c_str()) : job.fmt;
+
+	return fmt == FMT_TEXT;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Greedy, for batches too varied to search: the next chip is the
+// first listed one that can start with the type selected (one of the
+// same EPROM type as the last chip if possible), else the first
+// listed chip left. It ends with the type the most chips left have.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+can_start(const s_chipjob& job,const std::string& type) {
+
+	if ( fixed_order(job) )
+		return job.etype->segs[0].ppname == type;
+	return has_type(*job.etype,type);
+}
+
+static void
+schedule_greedy(std::vector<s_chipjob>& jobs,const std::string& selected) {
+	std::vector<s_chipjob> left(jobs), out;
+	std::string cur = selected;
+	const s_eprom_type *prev = 0;
+
+	while ( !left.empty() ) {
+		size_t pick = 0;
+		int best = -1;
+
+		for ( size_t j = 0; j < left.size(); ++j ) {
+			int score = can_start(left[j],cur) ? 1 + (left[j].etype == prev) : 0;
+
+			if ( score > best ) {
+				best = score;
+				pick = j;
+			}
+		}
+
+		s_chipjob job = left[pick];
+
+		left.erase(left.begin() + pick);
+
+		std::string last;
+		unsigned most = 0;
+
+		for ( auto it = job.etype->segs.begin(); it != job.etype->segs.end(); ++it ) {
+			unsigned n = 0;
+
+			if ( it->ppname == cur )
+				continue;
+			for ( auto jt = left.begin(); jt != left.end(); ++jt )
+				n += has_type(*jt->etype,it->ppname);
+			if ( n > most ) {
+				most = n;
+				last = it->ppname;
+			}
+		}
+
+		chip_order(job,cur,last);
+		cur = job.etype->segs[job.order.back()].ppname;
+		prev = job.etype;
+		out.push_back(job);
+	}
+	jobs.swap(out);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Exact search. Chips of the same EPROM type (and order freedom) are
+// interchangeable, so the state is just the type selected and how
+// many chips of each class are left; each chip is read with one S per
+// type group (less one when it starts with the type selected), and
+// only the type it ends with matters to the chips after it.
+//////////////////////////////////////////////////////////////////////
+
+static const double max_states = 200000;	// Beyond this, greedy
+
+struct s_jobclass {
+	const s_eprom_type	*etype;
+	bool			fixed;		// Text dump: configured order
+	std::vector<size_t>	jobs;		// In listed order
+	std::vector<std::string> types;		// Distinct segment types
+};
+
+struct s_step {
+	unsigned		selects;	// Fewest S from here on
+	int			cls;		// Class of the next chip (-1: done)
+	std::string		end;		// Type it ends with
+};
+
+struct s_planner {
+	std::vector<s_jobclass>	classes;
+	std::map<std::string,s_step> memo;
+
+	const s_step& best(const std::string& cur,std::vector<unsigned>& left);
+};
+
+//////////////////////////////////////////////////////////////////////
+// Ways to read a chip of class c with cur selected: (end type, S)
+//////////////////////////////////////////////////////////////////////
+
+static void
+chip_options(const s_jobclass& c,const std::string& cur,std::vector<std::pair<std::string,unsigned> >& opts) {
+	const std::vector<s_segment>& segs = c.etype->segs;
+	unsigned k = c.types.size();
+	bool have = has_type(*c.etype,cur);
+
+	opts.clear();
+	if ( c.fixed ) {
+		unsigned n = segs[0].ppname != cur;
+
+		for ( size_t x = 1; x < segs.size(); ++x )
+			n += segs[x].ppname != segs[x-1].ppname;
+		opts.push_back(std::make_pair(segs.back().ppname,n));
+		return;
+	}
+
+	for ( auto tt = c.types.begin(); tt != c.types.end(); ++tt )
+		if ( !have || k == 1 || *tt != cur )
+			opts.push_back(std::make_pair(*tt,have ? k - 1 : k));
+}
+
+const s_step&
+s_planner::best(const std::string& cur,std::vector<unsigned>& left) {
+	std::string key = cur;
+	std::vector<std::pair<std::string,unsigned> > opts;
+
+	for ( auto it = left.begin(); it != left.end(); ++it )
+		key += "," + std::to_string(*it);
+
+	auto mt = memo.find(key);
+
+	if ( mt != memo.end() )
+		return mt->second;
+
+	s_step step;
+
+	step.selects = 0;
+	step.cls = -1;
+
+	for ( size_t c = 0; c < classes.size(); ++c ) {
+		if ( left[c] == 0 )
+			continue;
+		chip_options(classes[c],cur,opts);
+		for ( auto ot = opts.begin(); ot != opts.end(); ++ot ) {
+			--left[c];
+			unsigned n = ot->second + best(ot->first,left).selects;
+			++left[c];
+
+			if ( step.cls < 0 || n < step.selects ) {
+				step.selects = n;
+				step.cls = c;
+				step.end = ot->first;
+			}
+		}
+	}
+	return memo[key] = step;
+}
+
+void
+schedule(std::vector<s_chipjob>& jobs,const std::string& selected) {
+	s_planner planner;
+	std::vector<std::string> alltypes;
+
+	for ( size_t j = 0; j < jobs.size(); ++j ) {
+		bool fixed = fixed_order(jobs[j]);
+		size_t c = 0;
+
+		while ( c < planner.classes.size()
+		  && (planner.classes[c].etype != jobs[j].etype || planner.classes[c].fixed != fixed) )
+			++c;
+		if ( c == planner.classes.size() ) {
+			s_jobclass cls;
+
+			cls.etype = jobs[j].etype;
+			cls.fixed = fixed;
+			for ( auto it = cls.etype->segs.begin(); it != cls.etype->segs.end(); ++it ) {
+				if ( std::find(cls.types.begin(),cls.types.end(),it->ppname) == cls.types.end() )
+					cls.types.push_back(it->ppname);
+				if ( std::find(alltypes.begin(),alltypes.end(),it->ppname) == alltypes.end() )
+					alltypes.push_back(it->ppname);
+			}
+			planner.classes.push_back(cls);
+		}
+		planner.classes[c].jobs.push_back(j);
+	}
+
+	double states = alltypes.size() + 1;
+	std::vector<unsigned> left, next(planner.classes.size(),0);
+
+	for ( auto it = planner.classes.begin(); it != planner.classes.end(); ++it ) {
+		left.push_back(it->jobs.size());
+		states *= it->jobs.size() + 1;
+	}
+	if ( states > max_states ) {
+		schedule_greedy(jobs,selected);
+		return;
+	}
+
+	std::vector<s_chipjob> out;
+	std::string cur = selected;
+
+	for (;;) {
+		s_step step = planner.best(cur,left);
+
+		if ( step.cls < 0 )
+			break;
+
+		s_chipjob job = jobs[planner.classes[step.cls].jobs[next[step.cls]++]];
+
+		chip_order(job,cur,step.end);
+		out.push_back(job);
+		--left[step.cls];
+		cur = step.end;
+	}
+	jobs.swap(out);
+}
+
+void
+plan_cost(const std::vector<s_chipjob>& jobs,const std::string& selected,const s_costmodel& model,s_plancost& cost) {
+	std::string cur = selected;
+
+	cost.selects = cost.loads = 0;
+	cost.bytes = 0;
+
+	for ( auto jt = jobs.begin(); jt != jobs.end(); ++jt ) {
+		std::string loaded;			// New chip: nothing loaded
+
+		for ( auto xt = jt->order.begin(); xt != jt->order.end(); ++xt ) {
+			const s_segment& seg = jt->etype->segs[*xt];
+
+			if ( seg.ppname != cur ) {
+				++cost.selects;
+				cur = seg.ppname;
+			}
+			if ( seg.ppname != loaded ) {
+				++cost.loads;
+				loaded = seg.ppname;
+			}
+			cost.bytes += jt->etype->segsize;
+		}
+	}
+
+	cost.secs = cost.selects * model.select + cost.loads * model.load + cost.bytes * model.per_byte;
+}
+
+// End sched.cpp
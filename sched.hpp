@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////
+// sched.hpp -- Segment scheduling for batches of chips
+///////////////////////////////////////////////////////////////////////
+
+#ifndef SCHED_HPP
+#define SCHED_HPP
+
+#include <string>
+#include <vector>
+
+#include "prompro.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Seconds each PROMPRO-8 step takes. The nominal model uses the S and
+// L command times (6 and 16 seconds) and Intel HEX upload at the line
+// rate; the measured model takes the averages seen on a unit so far.
+//////////////////////////////////////////////////////////////////////
+
+struct s_costmodel {
+	double		select;		// S: type switch
+	double		load;		// L: chip to buffer
+	double		per_byte;	// U: upload, per image byte
+};
+
+void cost_nominal(const s_unit& u,s_costmodel& model);
+void cost_measured(const s_unit& u,s_costmodel& model);
+
+//////////////////////////////////////////////////////////////////////
+// One chip of a batch, and the order its segments are read in
+//////////////////////////////////////////////////////////////////////
+
+struct s_chipjob {
+	const s_eprom_type *etype;
+	std::string	path;		// Output file
+	e_imgfmt	fmt;		// Output format (FMT_NONE: by extension)
+	std::vector<unsigned> order;	// Segment indexes, in read order
+	unsigned	n;		// Chip number, as listed (from 1)
+
+	s_chipjob() : etype(0), fmt(FMT_NONE), n(0) {}
+};
+
+struct s_plancost {
+	unsigned	selects;	// S commands
+	unsigned	loads;		// L commands
+	unsigned long	bytes;		// Bytes uploaded
+	double		secs;		// Predicted seconds
+};
+
+//////////////////////////////////////////////////////////////////////
+// A segment needs an S when its type differs from the one selected,
+// and an L unless it follows a segment of the same type on the same
+// chip (the buffer already holds that load). schedule() reorders the
+// jobs, and each job's segments, to need as few as it can: a chip
+// starts with the type left selected, and ends with the type most
+// wanted by the chips still to come. plan_cost() predicts a plan.
+//////////////////////////////////////////////////////////////////////
+
+void plan_listed(std::vector<s_chipjob>& jobs);
+void schedule(std::vector<s_chipjob>& jobs,const std::string& selected);
+void plan_cost(const std::vector<s_chipjob>& jobs,const std::string& selected,const s_costmodel& model,s_plancost& cost);
+
+#endif // SCHED_HPP
+
+// End sched.hpp
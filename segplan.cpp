@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////
+// segplan.cpp -- Segment plans derived from the programmer's type codes
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "segplan.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Size of a 27 series part from its number (27C512, 27C010, 2764A..)
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+part_size(const std::string& name) {
+	static const struct {
+		const char	*number;
+		unsigned	size;
+	} parts[] = {
+		{ "16",   2048 },	{ "32",   4096 },	{ "64",   8192 },
+		{ "128",  16384 },	{ "256",  32768 },	{ "512",  65536 },
+		{ "010",  131072 },	{ "1001", 131072 },	{ "020",  262144 },
+		{ "2001", 262144 },	{ "040",  524288 },	{ "4001", 524288 },
+		{ "080",  1048576 },	{ "801",  1048576 },
+	};
+	size_t x = 2, d;
+
+	if ( name.compare(0,2,"27") != 0 )
+		return 0;
+	while ( x < name.size() && isalpha(name[x]) )
+		++x;				// 27C, 27HC ..
+	for ( d = x; d < name.size() && isdigit(name[d]); ++d )
+		;
+	if ( d < name.size() && !(d + 1 == name.size() && isalpha(name[d])) )
+		return 0;			// Only a revision letter may follow
+
+	std::string number = name.substr(x,d - x);
+
+	for ( unsigned p = 0; p < sizeof parts / sizeof parts[0]; ++p )
+		if ( number == parts[p].number )
+			return parts[p].size;
+	return 0;
+}
+
+static unsigned
+gcd(unsigned a,unsigned b) {
+
+	while ( b ) {
+		unsigned t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Cover the part with the fewest windows (each costs an S and an L
+// per chip): from the first address not yet covered, take the window
+// that reaches furthest past it. Where windows overlap, the later one
+// reads only what is left. The windows are then cut into segments of
+// one size (the largest that divides them all), so that the segments
+// of a window follow each other and share its load.
+//////////////////////////////////////////////////////////////////////
+
+bool
+plan_segments(const s_programmer& prog,unsigned size,s_eprom_type& etype) {
+	struct s_piece {
+		const s_typecode *code;
+		unsigned	from, to;
+	};
+	std::vector<s_piece> pieces;
+	unsigned cur = 0, segsize = 0;
+
+	while ( cur < size ) {
+		const s_typecode *best = 0;
+		unsigned reach = cur;
+
+		for ( auto it = prog.codes.begin(); it != prog.codes.end(); ++it ) {
+			unsigned end;
+
+			if ( (it->part != 0 && it->part != size) || it->offset > cur || it->offset >= size )
+				continue;
+			end = it->size > 0 ? it->offset + it->size : size;
+			if ( end > it->offset + prog.buffer )
+				end = it->offset + prog.buffer;
+			if ( end > size )
+				end = size;
+			if ( end > reach ) {
+				reach = end;
+				best = &*it;
+			}
+		}
+
+		if ( !best ) {
+			fprintf(stderr,"No <programmer> type code reads address 0x%X of a %u byte %s\n",
+				cur,
+				size,
+				etype.name.c_str());
+			return false;
+		}
+
+		s_piece p;
+
+		p.code = best;
+		p.from = cur;
+		p.to = reach;
+		pieces.push_back(p);
+		segsize = gcd(gcd(segsize,cur),reach);
+		cur = reach;
+	}
+
+	etype.segsize = segsize;
+	etype.segs.clear();
+	for ( auto it = pieces.begin(); it != pieces.end(); ++it ) {
+		unsigned n = (it->to - it->from) / segsize;
+
+		for ( unsigned k = 0; k < n; ++k ) {
+			s_segment seg;
+
+			seg.ppname = it->code->ppname;
+			seg.offset = it->from + k * segsize;
+			seg.base = it->code->offset;	// Where L loads from, not where the piece starts
+			seg.title = it->code->title != "" ? it->code->title : it->code->ppname;
+			if ( n > 1 )
+				seg.title += "." + std::to_string(k + 1);
+			etype.segs.push_back(seg);
+		}
+	}
+
+	if ( verbose ) {
+		printf("EPROM type %s planned as %u windows, %u segments of %u bytes:",
+			etype.name.c_str(),
+			unsigned(pieces.size()),
+			unsigned(etype.segs.size()),
+			segsize);
+		for ( auto it = pieces.begin(); it != pieces.end(); ++it )
+			printf(" %s@0x%X",it->code->ppname.c_str(),it->from);
+		putchar('\n');
+	}
+	return true;
+}
+
+// End segplan.cpp
@@ -0,0 +1,47 @@
+///////////////////////////////////////////////////////////////////////
+// segplan.hpp -- Segment plans derived from the programmer's type codes
+///////////////////////////////////////////////////////////////////////
+
+#ifndef SEGPLAN_HPP
+#define SEGPLAN_HPP
+
+#include <string>
+#include <vector>
+
+#include "prompro.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// A PROMPRO-8 type code, as configured in <programmer>:
+//
+//	<programmer buffer="16384">
+//		<type use="12" part="32768" title="256L" />
+//		<type use="13" part="32768" offset="16384" title="256U" />
+//	</programmer>
+//
+// Selecting the code and loading (L) puts the chip bytes from offset
+// in the buffer: size of them (default: the rest of the part), but no
+// more than the buffer holds. A code is used for parts of its part
+// size only (part="0": any size).
+//////////////////////////////////////////////////////////////////////
+
+struct s_typecode {
+	std::string	ppname;		// PROMPRO type code
+	std::string	title;		// As shown on PROMPRO-8
+	unsigned	part;		// Part size it is for (0: any)
+	unsigned	offset;		// First chip address loaded
+	unsigned	size;		// Bytes it reaches (0: to the end)
+};
+
+struct s_programmer {
+	unsigned	buffer;		// PROMPRO-8 buffer size
+	std::vector<s_typecode> codes;
+
+	s_programmer() : buffer(16384) {}
+};
+
+unsigned part_size(const std::string& name);	// 0 if not a known part
+bool plan_segments(const s_programmer& prog,unsigned size,s_eprom_type& etype);
+
+#endif // SEGPLAN_HPP
+
+// End segplan.hpp
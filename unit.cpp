@@ -0,0 +1,595 @@
+///////////////////////////////////////////////////////////////////////
+// unit.cpp -- Serial transport and commands for one Prompro-8 unit
+// Date: Sun Feb  8 16:34:07 2015  (C) Warren W. Gay VE3WWG
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+#include "prompro.hpp"
+#include "perfmon.hpp"
+
+bool cmd_debug = false;				// When true, show serial trafic for debugging
+bool verbose = false;				// Verbose messages when true
+int rtimeout_ms = 2000;				// Read timeout in ms
+
+double
+now_secs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+void
+wire_begin(s_unit& u,const char *cmd) {
+	u.wire = &u.wirestats[cmd];
+	u.wire->count++;
+	u.wire_t0 = now_secs();
+}
+
+void
+wire_end(s_unit& u) {
+	if ( u.wire )
+		u.wire->secs += now_secs() - u.wire_t0;
+	u.wire = 0;
+}
+
+static void
+wire_rx(s_unit& u,int ch) {
+	s_wirestat& w = u.wire ? *u.wire : u.discard;
+
+	w.rx++;
+	if ( isxdigit(ch) )
+		w.rx_hex++;
+	else if ( ch == '*' )
+		w.rx_prompt++;
+	else if ( ch == '\r' || ch == '\n' || ch == ' ' || ch == ':' )
+		w.rx_fmt++;
+	else	w.rx_other++;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Bits on the wire per character: start + 8 data + parity + stop
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+bits_per_char() {
+	return 1 + 8 + 1 + 1;
+}
+
+void
+report_wirestats(const s_unit& u) {
+	double limit = double(u.baud_rate) / bits_per_char();	// Max chars/sec
+	s_wirestat tot;
+
+	memset(&tot,0,sizeof tot);
+
+	printf("\nWire efficiency of %s (%u baud, %u bits/char, limit %.1f bytes/s each way):\n",
+		u.name.c_str(),u.baud_rate,bits_per_char(),limit);
+	printf("%-4s %5s %5s %8s %8s %8s %7s %7s %7s %8s %6s %8s %9s %9s %6s %8s\n",
+		"Cmd","Count","Retry","Payload","TX","RX","Hex","Fmt","Prompt","Echo/oth",
+		"Wire/P","Syscalls","Secs","Eff B/s","Util%","Dev secs");
+
+	for ( auto it = u.wirestats.begin(); it != u.wirestats.end(); ++it ) {
+		const s_wirestat& w = it->second;
+		unsigned long onwire = w.tx + w.rx;
+		double wire_secs = limit > 0 ? double(w.tx > w.rx ? w.tx : w.rx) / limit : 0.0;
+		double dev_secs = w.secs > wire_secs ? w.secs - wire_secs : 0.0;
+		char ratio[16];
+
+		if ( w.payload > 0 )
+			snprintf(ratio,sizeof ratio,"%.2f",double(onwire) / w.payload);
+		else	strcpy(ratio,"-");
+
+		printf("%-4s %5lu %5lu %8lu %8lu %8lu %7lu %7lu %7lu %8lu %6s %8lu %9.3f %9.1f %6.1f %8.3f\n",
+			it->first.c_str(),
+			w.count,
+			w.retries,
+			w.payload,
+			w.tx,
+			w.rx,
+			w.rx_hex,
+			w.rx_fmt,
+			w.rx_prompt,
+			w.rx_other,
+			ratio,
+			w.syscalls,
+			w.secs,
+			w.secs > 0.0 ? w.payload / w.secs : 0.0,
+			w.secs > 0.0 && limit > 0 ? 100.0 * (w.rx / w.secs) / limit : 0.0,
+			dev_secs);
+
+		tot.count += w.count;
+		tot.retries += w.retries;
+		tot.payload += w.payload;
+		tot.tx += w.tx;
+		tot.rx += w.rx;
+		tot.syscalls += w.syscalls;
+		tot.secs += w.secs;
+	}
+
+	if ( tot.payload > 0 && tot.secs > 0.0 ) {
+		double ideal = limit > 0 ? tot.payload / limit : 0.0;
+
+		printf("Total: %lu payload bytes, %lu wire bytes (%.2f wire bytes per payload byte)\n",
+			tot.payload,tot.tx + tot.rx,double(tot.tx + tot.rx) / tot.payload);
+		printf("       %.1f payload bytes/s effective vs %.1f bytes/s raw line limit (%.1f%%)\n",
+			tot.payload / tot.secs,limit,limit > 0 ? 100.0 * (tot.payload / tot.secs) / limit : 0.0);
+		printf("       %.3f secs total, %.3f secs would suffice to move the payload alone\n",
+			tot.secs,ideal);
+		printf("       %.2f syscalls per payload byte\n",double(tot.syscalls) / tot.payload);
+		if ( tot.retries > 0 )
+			printf("       %lu commands reissued after bad replies\n",tot.retries);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Poll for input:
+// Returns:
+//	1	At least one byte available to be read
+//	0	Timeout occurred
+//	-1	Error occurred (dev no longer open?)
+//////////////////////////////////////////////////////////////////////
+
+static int
+pollch(s_unit& u,int timeout_ms) {
+        struct pollfd pinfo;
+	int rc;
+
+        pinfo.fd = u.fd;
+        pinfo.events = POLLIN;
+        pinfo.revents = 0;
+
+	rc = poll(&pinfo,1,timeout_ms);
+	if ( u.wire )
+		u.wire->syscalls++;
+
+	if ( rc < 1 && cmd_debug && !u.quiet ) {
+		fprintf(stderr,"poll(timeout=%d ms) returned %d",timeout_ms,rc);
+		if ( rc < 0 )
+			fprintf(stderr," (%s)\n",strerror(errno));
+		else	fputc('\n',stderr);
+		fflush(stderr);
+	}
+
+	return rc;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The device failed. That ends the run, except on a unit owned by a
+// gang worker: it is marked unhealthy, and its reads time out at once.
+//////////////////////////////////////////////////////////////////////
+
+static void
+device_error(s_unit& u,int err) {
+
+	fprintf(stderr,"ERROR %s: reading device %s\n",
+		strerror(err),
+		u.device.c_str());
+	if ( !u.owned )
+		exit(3);
+	u.healthy = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read 1 byte else timeout (-1 is return upon timeout)
+//////////////////////////////////////////////////////////////////////
+
+int
+readch(s_unit& u,int timeout) {
+	unsigned char ch;
+	int rc;
+
+	if ( u.owned && !u.healthy )
+		return -1;		// Lost: don't wait on it again
+
+	rc = pollch(u,timeout);
+	if ( rc == -1 ) {
+		device_error(u,errno);
+		return -1;
+	}
+
+	if ( rc == 0 )
+		return -1;		// Indicate timeout
+
+	do	{
+		rc = read(u.fd,&ch,1);
+		if ( u.wire )
+			u.wire->syscalls++;
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( rc != 1 ) {
+		device_error(u,rc == 0 ? EIO : errno);	// Unplugged, hung up
+		return -1;
+	}
+	wire_rx(u,ch);
+	u.last_io = now_secs();
+
+	if ( cmd_debug && !u.quiet ) {
+		if ( isprint(ch) ) {
+			fprintf(stderr," <= '%c'\n",ch);
+		} else	{
+			fprintf(stderr," <= 0x%02X\n",ch);
+		}
+	}
+
+	return int(ch);
+}
+
+void
+writech(s_unit& u,const char *data) {
+	int n = strlen(data);
+	int rc;
+
+	do	{
+		rc = write(u.fd,data,n);
+		if ( u.wire )
+			u.wire->syscalls++;
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( u.wire && rc > 0 )
+		u.wire->tx += rc;
+
+	if ( cmd_debug && !u.quiet && n > 0 ) {
+		for ( int x=0; x<n; ++x ) {
+			char ch = data[x];
+
+			if ( isprint(ch) ) {
+				fprintf(stderr," => '%c'\n",ch);
+			} else	{
+				fprintf(stderr," => 0x%02X\n",ch);
+			}
+		}
+	}
+
+	assert(rc == rc);
+}
+
+void
+writecr(s_unit& u) {
+	writech(u,"\r");
+}
+
+//////////////////////////////////////////////////////////////////////
+// A unit stopped answering. That ends the run, except on a unit owned
+// by a gang worker: it is marked unhealthy and the command fails, so
+// the worker can hand its chip to the other units.
+//////////////////////////////////////////////////////////////////////
+
+void
+timeout(s_unit& u,const char *message) {
+
+	if ( u.owned ) {
+		fprintf(stderr,"TIMEOUT: %s on %s\n",message,u.name.c_str());
+		u.prompro_type.clear();
+		u.healthy = false;
+		return;
+	}
+	fputs("TIMEOUT: ",stderr);
+	fputs(message,stderr);
+	fputs("\n",stderr);
+	exit(13);
+}
+
+bool
+get_prompt(s_unit& u,int timeout_ms) {
+	int ch;
+
+	if ( timeout_ms <= 0 )
+		timeout_ms = rtimeout_ms;
+
+	do	{
+		ch = readch(u,timeout_ms);
+		if ( ch == -1 )
+			return false;	// Timeout
+	} while ( ch != '*' );
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Asynchronous commands: the command is written and the unit is
+// marked busy. The event loop (or command_finish()) consumes the
+// reply until the '*' prompt arrives or the deadline passes.
+//////////////////////////////////////////////////////////////////////
+
+void
+command_start(s_unit& u,const char *wirename,const char *cmd,int timeout_ms,const char *what) {
+
+	assert(!u.busy);
+	wire_begin(u,wirename);
+	writech(u,cmd);
+	u.busy = true;
+	u.busy_what = what;
+	u.deadline = now_secs() + timeout_ms / 1000.0;
+}
+
+void
+command_done(s_unit& u,bool ok) {
+
+	if ( ok ) {
+		if ( u.busy_type != "" )
+			u.prompro_type = u.busy_type;
+	} else	{
+		fprintf(stderr,"TIMEOUT: %s on %s\n",u.busy_what.c_str(),u.name.c_str());
+		u.prompro_type.clear();
+		u.healthy = false;
+	}
+
+	wire_end(u);
+	u.busy = false;
+	u.busy_type.clear();
+}
+
+bool
+command_finish(s_unit& u) {
+
+	if ( !u.busy )
+		return u.healthy;
+
+	double left = u.deadline - now_secs();
+	bool ok = left > 0.0 && get_prompt(u,int(left * 1000.0) + 1);
+
+	command_done(u,ok);
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Consume whatever a unit has sent us without blocking. Returns false
+// if the device has gone away.
+//////////////////////////////////////////////////////////////////////
+
+bool
+service_unit(s_unit& u) {
+	unsigned char buf[256];
+	int rc;
+
+	do	{
+		rc = read(u.fd,buf,sizeof buf);
+		if ( u.wire )
+			u.wire->syscalls++;
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( rc <= 0 )
+		return false;
+
+	u.last_io = now_secs();
+	for ( int x=0; x<rc; ++x ) {
+		wire_rx(u,buf[x]);
+		if ( cmd_debug && !u.quiet )
+			fprintf(stderr," <= (%s) 0x%02X\n",u.name.c_str(),buf[x]);
+		if ( buf[x] == '*' && u.busy )
+			command_done(u,true);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Keepalive: an idle unit is sent a CR, and must answer with its '*'
+// prompt within ktimeout_ms, else it is marked unhealthy.
+//////////////////////////////////////////////////////////////////////
+
+void
+keepalive(s_unit& u,double now) {
+
+	if ( u.fd < 0 || !u.healthy || u.busy || u.keepalive_ms <= 0 )
+		return;
+	if ( (now - u.last_io) * 1000.0 < u.keepalive_ms )
+		return;
+
+	command_start(u,"KA","\r",u.ktimeout_ms,"Keepalive");
+	u.last_io = now;
+}
+
+static bool
+select_type(s_unit& u,const char *type) {
+	const char *phase = perf_phase("select");
+	bool ok;
+
+	command_finish(u);
+	wire_begin(u,"S");
+	writech(u,"S");
+	writech(u,type);
+	writecr(u);
+	if ( !(ok = get_prompt(u,6000)) )
+		timeout(u,"Selecting PROMPRO EPROM type");
+	wire_end(u);
+	perf_phase(phase);
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the relocation address: the PROMPRO buffer is addressed from
+// addr, so U commands take chip addresses within the segment.
+//////////////////////////////////////////////////////////////////////
+
+bool
+relocate(s_unit& u,unsigned addr) {
+	char buf[32];
+	bool ok;
+
+	command_finish(u);
+	wire_begin(u,"R");
+	sprintf(buf,"R%04X\r",addr);
+	writech(u,buf);
+	if ( !(ok = get_prompt(u,16000)) )
+		timeout(u,"Setting Relocation address");
+	wire_end(u);
+	return ok;
+}
+
+bool
+load(s_unit& u) {
+	const char *phase = perf_phase("load");
+	bool ok;
+
+	command_finish(u);
+	wire_begin(u,"L");
+	writech(u,"L\r");
+	if ( !(ok = get_prompt(u,16000)) )
+		timeout(u,"Loading from EPROM");
+	wire_end(u);
+	perf_phase(phase);
+	return ok;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Cut an upload short: ESC stops the transfer, and whatever is still
+// in flight is drained until the line goes quiet. The upload may have
+// ended on its own before the ESC got there, so more than one '*' can
+// arrive; the unit is in sync if the last thing seen was a prompt,
+// else a CR resyncs. A unit that ignores ESC just finishes its upload.
+//////////////////////////////////////////////////////////////////////
+
+bool
+abort_upload(s_unit& u) {
+	int quiet_ms = u.baud_rate > 0		// 20 character times, else a fixed wait
+		? 100 + 20 * bits_per_char() * 1000 / u.baud_rate : 250;
+	bool prompt = false;
+	int ch;
+
+	writech(u,"\x1B");
+	while ( (ch = readch(u,quiet_ms)) != -1 ) {
+		if ( ch == '*' )
+			prompt = true;
+		else if ( ch != '\r' && ch != '\n' )
+			prompt = false;
+	}
+
+	if ( prompt )
+		return true;
+	writecr(u);
+	return get_prompt(u,2000);
+}
+
+bool
+select_type(s_unit& u,const s_segment& seg) {
+
+	if ( !command_finish(u) ) {
+		timeout(u,"Selecting PROMPRO EPROM type");
+		return false;
+	}
+
+	if ( u.prompro_type != seg.ppname ) {
+		if ( verbose )
+			printf("Selecting PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
+		if ( !select_type(u,seg.ppname.c_str()) )
+			return false;
+		u.prompro_type = seg.ppname;
+	} else	{
+		if ( verbose )
+			printf("Continuing to use PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start selecting the type of the first segment to be read (index
+// first) without waiting for the 6 second reply, so it overlaps with
+// operator chip handling.
+//////////////////////////////////////////////////////////////////////
+
+bool
+select_type_start(s_unit& u,const s_eprom_type& etype,unsigned first) {
+
+	if ( etype.segs.size() <= first ) {
+		fprintf(stderr,"XML misconfiguration for EPROM type '%s'\n",
+			etype.name.c_str());
+		exit(1);
+	}
+
+	const s_segment& seg = etype.segs[first];
+
+	if ( !command_finish(u) ) {
+		timeout(u,"Waiting for PROMPRO-8");
+		return false;
+	}
+
+	if ( u.prompro_type == seg.ppname ) {
+		if ( verbose )
+			printf("Continuing to use PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
+		return true;
+	}
+
+	std::string cmd = "S" + seg.ppname + "\r";
+
+	if ( verbose )
+		printf("Selecting PROMPRO type %s (%s)\n",seg.ppname.c_str(),seg.title.c_str());
+	u.prompro_type.clear();
+	command_start(u,"S",cmd.c_str(),6000,"Selecting PROMPRO EPROM type");
+	u.busy_type = seg.ppname;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open and configure a unit's serial port, then sync to its prompt
+//////////////////////////////////////////////////////////////////////
+
+bool
+open_unit(s_unit& u) {
+	const char *phase = perf_phase("port");
+
+	u.fd = open(u.device.c_str(),O_RDWR,0);
+	if ( u.fd == -1 ) {
+		fprintf(stderr,"%s: Unable to open serial device %s\n",
+			strerror(errno),
+			u.device.c_str());
+		u.healthy = false;
+		perf_phase(phase);
+		return false;
+	}
+
+	if ( tcgetattr(u.fd,&u.term) < 0 ) {
+		fprintf(stderr,"%s: getting serial port attributes of %s\n",
+			strerror(errno),
+			u.device.c_str());
+		close(u.fd);
+		u.fd = -1;
+		u.healthy = false;
+		perf_phase(phase);
+		return false;
+	}
+
+	tcflush(u.fd,TCIOFLUSH);		// Flush all in/out chars in transit
+	cfmakeraw(&u.term);			// Setup for raw I/O
+	cfsetspeed(&u.term,u.baud_rate);	// Set baud rate
+	u.term.c_cflag |= PARODD | PARENB;	// Set odd parity
+	if ( u.rtscts ) {
+		u.term.c_cflag |= CRTSCTS;	// Enable RTS/CTS flow control
+	} else	{
+		u.term.c_cflag &= ~CRTSCTS;	// Disable RTS/CTS flow control
+	}
+
+	if ( tcsetattr(u.fd,TCSANOW,&u.term) < 0 ) { // Apply changes to serial port
+		fprintf(stderr,"%s: Setting serial port attributes of %s\n",
+			strerror(errno),
+			u.device.c_str());
+	}
+
+	wire_begin(u,"CR");
+	writech(u,"\r");
+
+	if ( !get_prompt(u) ) {
+		fprintf(stderr,"PROMPRO-8 %s is not ready.\n",u.name.c_str());
+		wire_end(u);
+		u.healthy = false;
+		perf_phase(phase);
+		return false;
+	}
+	wire_end(u);
+	u.healthy = true;
+	perf_phase(phase);
+	return true;
+}
+
+// End unit.cpp
@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////
+// updecode.cpp -- Incremental decoder for the PROMPRO-8 'U' upload
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "updecode.hpp"
+#include "hexcodec.hpp"
+
+static int
+hexval(int ch) {
+
+	if ( ch >= '0' && ch <= '9' )
+		return ch - '0';
+	if ( ch >= 'A' && ch <= 'F' )
+		return ch - 'A' + 10;
+	if ( ch >= 'a' && ch <= 'f' )
+		return ch - 'a' + 10;
+	return -1;
+}
+
+void
+s_updecoder::begin(unsigned char *image,unsigned base,unsigned size) {
+
+	this->image = image;
+	this->base = base;
+	this->size = size;
+	filled = contig = next = ext = 0;
+	changed = 0;
+	records = ihex_records = bad_sums = bad_records = out_of_range = text_lines = 0;
+	eof = done = false;
+	line.clear();
+	have.assign(size,0);
+}
+
+bool
+s_updecoder::feed(int ch) {
+
+	if ( done )
+		return true;
+
+	if ( ch == '*' ) {
+		end_line();
+		done = true;
+	} else if ( ch == '\r' || ch == '\n' ) {
+		end_line();
+	} else	{
+		line += char(ch);
+	}
+	return done;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Feed a block of upload text (e.g. an archived dump), taking whole
+// spans between line ends at a time. Stops after the '*' prompt.
+//////////////////////////////////////////////////////////////////////
+
+size_t
+s_updecoder::feed(const char *text,size_t n) {
+	size_t x = 0;
+
+	while ( x < n && !done ) {
+		size_t e = x;
+
+		while ( e < n && text[e] != '\r' && text[e] != '\n' && text[e] != '*' )
+			++e;
+		line.append(text + x,e - x);
+		if ( e < n )
+			feed(text[e++]);
+		x = e;
+	}
+	return x;
+}
+
+bool
+s_updecoder::complete() const {
+	return filled == size && errors() == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// A segment upload is only trusted when it is complete and framed:
+// it ended at the prompt, and an Intel HEX upload had its EOF record
+// (a plain hex upload has none). An upload started from byte from
+// need only be complete from there.
+//////////////////////////////////////////////////////////////////////
+
+bool
+s_updecoder::valid(unsigned from) const {
+	return fault(from) == 0;
+}
+
+const char *
+s_updecoder::fault(unsigned from) const {
+
+	if ( !done )
+		return "no prompt (stalled)";
+	if ( bad_sums > 0 )
+		return "record checksum errors";
+	if ( bad_records > 0 )
+		return "malformed records";
+	if ( out_of_range > 0 )
+		return "bytes outside the segment";
+	for ( unsigned x = from; x < size; ++x )
+		if ( !have[x] )
+			return "missing bytes";
+	if ( ihex_records > 0 && !eof )
+		return "no EOF record";
+	return 0;
+}
+
+unsigned
+s_updecoder::errors() const {
+	return bad_sums + bad_records + out_of_range;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store one byte. Addresses within [base,base+size) are absolute,
+// else addresses below size are taken as segment relative.
+//////////////////////////////////////////////////////////////////////
+
+void
+s_updecoder::store(unsigned addr,unsigned char byte) {
+	unsigned x;
+
+	if ( addr >= base && addr - base < size )
+		x = addr - base;
+	else if ( addr < size )
+		x = addr;
+	else	{
+		++out_of_range;
+		return;
+	}
+
+	if ( !have[x] ) {
+		have[x] = 1;
+		++filled;
+		while ( contig < size && have[contig] )
+			++contig;
+	} else if ( image[x] != byte )
+		++changed;
+	image[x] = byte;
+}
+
+void
+s_updecoder::end_line() {
+	size_t x = 0;
+
+	while ( x < line.size() && (line[x] == ' ' || line[x] == '\t') )
+		++x;
+
+	if ( x < line.size() ) {
+		if ( line[x] == ':' ) {
+			line.erase(0,x);
+			ihex_record();
+		} else if ( hexval(line[x]) >= 0 ) {
+			hex_line();
+		} else	{
+			++text_lines;
+		}
+	}
+	line.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// :LLAAAATT<LL data bytes>CC -- all bytes sum to zero mod 256
+//////////////////////////////////////////////////////////////////////
+
+void
+s_updecoder::ihex_record() {
+	size_t len = line.size();
+	unsigned char rec[255+5];
+	unsigned n, sum = 0;
+
+	while ( len > 1 && (line[len-1] == ' ' || line[len-1] == '\t') )
+		--len;
+
+	if ( len < 11 || (len - 1) % 2 != 0 || (len - 1) / 2 > sizeof rec
+	  || !hex_decode(line.data() + 1,len - 1,rec) ) {
+		++bad_records;
+		return;
+	}
+
+	n = (len - 1) / 2;
+	for ( unsigned x = 0; x < n; ++x )
+		sum += rec[x];
+
+	if ( rec[0] + 5u != n ) {
+		++bad_records;
+		return;
+	}
+
+	if ( (sum & 0xFF) != 0 ) {
+		++bad_sums;
+		return;
+	}
+
+	unsigned addr = ext + (unsigned(rec[1]) << 8 | rec[2]);
+
+	switch ( rec[3] ) {
+	case 0x00:			// Data
+		for ( unsigned x = 0; x < rec[0]; ++x )
+			store(addr + x,rec[4+x]);
+		++records;
+		++ihex_records;
+		break;
+	case 0x01:			// EOF
+		eof = true;
+		break;
+	case 0x02:			// Extended segment address
+		if ( rec[0] == 2 )
+			ext = (unsigned(rec[4]) << 8 | rec[5]) << 4;
+		else	++bad_records;
+		break;
+	case 0x04:			// Extended linear address
+		if ( rec[0] == 2 )
+			ext = (unsigned(rec[4]) << 8 | rec[5]) << 16;
+		else	++bad_records;
+		break;
+	case 0x03:			// Start addresses: no data
+	case 0x05:
+		break;
+	default:
+		++bad_records;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Whitespace separated groups of hex digit pairs
+//////////////////////////////////////////////////////////////////////
+
+void
+s_updecoder::hex_line() {
+	unsigned char buf[256];
+	size_t x = 0, len = line.size();
+
+	while ( x < len ) {
+		if ( line[x] == ' ' || line[x] == '\t' ) {
+			++x;
+			continue;
+		}
+
+		size_t e = x;
+
+		while ( e < len && line[e] != ' ' && line[e] != '\t' && e - x < 2 * sizeof buf )
+			++e;
+
+		if ( !hex_decode(line.data() + x,e - x,buf) ) {
+			++bad_records;		// Odd digit count or junk
+			return;
+		}
+
+		for ( size_t b = 0; b < (e - x) / 2; ++b )
+			store(base + next++,buf[b]);
+		x = e;
+	}
+
+	++records;
+}
+
+// End updecode.cpp
@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////
+// updecode.hpp -- Incremental decoder for the PROMPRO-8 'U' upload
+///////////////////////////////////////////////////////////////////////
+
+#ifndef UPDECODE_HPP
+#define UPDECODE_HPP
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+// The upload is fed one character at a time as it arrives. Lines are
+// decoded as they complete:
+//
+//	:LLAAAATT<data>CC	Intel HEX record (checksum verified)
+//	hh hh hhhh ...		Plain hex bytes, stored sequentially
+//	anything else		Command echo / text, ignored
+//
+// Record addresses may be absolute (base + n) or relative to the
+// segment (n). The upload ends at the '*' prompt.
+//////////////////////////////////////////////////////////////////////
+
+struct s_updecoder {
+	unsigned char	*image;		// Destination: size bytes for this segment
+	unsigned	base;		// Address of image[0] (U command offset)
+	unsigned	size;		// Segment size in bytes
+	unsigned	filled;		// Distinct bytes stored
+	unsigned	contig;		// Leading bytes stored (image[0..contig))
+	unsigned	changed;	// Stored bytes later rewritten differently
+	unsigned	next;		// Next index for plain hex lines
+	unsigned	ext;		// Extended address from type 02/04 records
+	unsigned	records;	// Good data records
+	unsigned	ihex_records;	// Of those, Intel HEX type 00 records
+	unsigned	bad_sums;	// Records failing their checksum
+	unsigned	bad_records;	// Malformed records
+	unsigned	out_of_range;	// Bytes addressed outside the segment
+	unsigned	text_lines;	// Non-data lines (echo etc.)
+	bool		eof;		// Intel HEX EOF record seen
+	bool		done;		// '*' prompt seen
+	std::string	line;		// Line being received
+	std::vector<unsigned char> have; // Per byte: stored yet?
+
+	void begin(unsigned char *image,unsigned base,unsigned size);
+	bool feed(int ch);		// Returns true at the '*' prompt
+	size_t feed(const char *text,size_t n); // Bulk feed: returns chars used
+	bool complete() const;		// All bytes stored, no errors
+	bool valid(unsigned from=0) const; // Complete from byte from, prompt and EOF seen
+	const char *fault(unsigned from=0) const; // Why not valid (null if valid)
+	unsigned errors() const;
+
+private:
+	void end_line();
+	void ihex_record();
+	void hex_line();
+	void store(unsigned addr,unsigned char byte);
+};
+
+#endif // UPDECODE_HPP
+
+// End updecode.hpp
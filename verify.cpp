@@ -0,0 +1,404 @@
+///////////////////////////////////////////////////////////////////////
+// verify.cpp -- Compare an EPROM against a reference image
+//
+// The reference is memory mapped and each byte is compared as the
+// upload decodes it, so a wrong chip can be rejected (with -A) after
+// the first differing line instead of after the whole read. A .ppz
+// reference is decompressed a segment at a time, just before the
+// segment is read.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "prompro.hpp"
+#include "perfmon.hpp"
+#include "updecode.hpp"
+#include "ppzfile.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+static const unsigned max_ranges = 32;	// Mismatch ranges listed
+
+//////////////////////////////////////////////////////////////////////
+// A reference image: a flat binary, mapped, or a .ppz file, whose
+// segments are decompressed only as they are fetched
+//////////////////////////////////////////////////////////////////////
+
+struct s_refimage {
+	const char	*path;
+	const unsigned char *map;	// Flat binary
+	size_t		maplen;
+	bool		packed;		// Else a .ppz file:
+	s_ppzfile	ppz;
+	std::vector<unsigned char> unpacked; // Its segments fetched so far
+
+	s_refimage() : path(0), map(0), maplen(0), packed(false) {}
+	~s_refimage() {
+		if ( map )
+			munmap((void *)map,maplen);
+	}
+
+	void open(const char *path);
+	const unsigned char *fetch(unsigned addr,unsigned n);
+
+	const unsigned char *bytes() const { return packed ? unpacked.data() : map; }
+	size_t size() const { return packed ? unpacked.size() : maplen; }
+};
+
+void
+s_refimage::open(const char *path) {
+	struct stat st;
+	void *m;
+	int fd;
+
+	this->path = path;
+
+	if ( imgfmt_from_path(path) == FMT_PPZ ) {
+		const char *why = ppz.open(path);
+
+		if ( why ) {
+			fprintf(stderr,"%s: Opening reference image %s\n",why,path);
+			exit(2);
+		}
+		packed = true;
+		unpacked.assign(ppz.size,0xFF);
+		return;
+	}
+
+	fd = ::open(path,O_RDONLY);
+	if ( fd == -1 || fstat(fd,&st) == -1 ) {
+		fprintf(stderr,"%s: Opening reference image %s\n",
+			strerror(errno),
+			path);
+		exit(2);
+	}
+
+	if ( st.st_size <= 0 ) {
+		fprintf(stderr,"Reference image %s is empty\n",path);
+		exit(2);
+	}
+
+	m = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	if ( m == MAP_FAILED ) {
+		fprintf(stderr,"%s: Mapping reference image %s\n",
+			strerror(errno),
+			path);
+		exit(2);
+	}
+	close(fd);
+
+	map = (const unsigned char *)m;
+	maplen = st.st_size;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Make reference bytes [addr,addr+n) available at bytes() + addr
+//////////////////////////////////////////////////////////////////////
+
+const unsigned char *
+s_refimage::fetch(unsigned addr,unsigned n) {
+
+	if ( packed && addr < unpacked.size() ) {
+		if ( n > unpacked.size() - addr )
+			n = unpacked.size() - addr;
+		if ( !ppz.read(addr,n,unpacked.data() + addr) ) {
+			fprintf(stderr,"Reference image %s: damaged segment at 0x%04X\n",path,addr);
+			exit(2);
+		}
+	}
+	return bytes();
+}
+
+struct s_verifier : s_upwatch {
+	const unsigned char	*ref;		// Mapped reference image
+	size_t			reflen;
+	const unsigned char	*image;		// Image being uploaded
+	bool			abort_first;	// Stop at the first difference
+	unsigned		pos;		// Next address to compare
+	unsigned long		compared;
+	unsigned long		differ;
+	std::vector<std::pair<unsigned,unsigned> > ranges; // [start,end)
+	const s_segment		*unread;	// Segment that failed to read, if any
+	const char		*why;		// Its decoder fault
+
+	s_verifier() : ref(0), reflen(0), image(0), abort_first(false), pos(0), compared(0), differ(0), unread(0), why(0) {}
+
+	unsigned char expect(unsigned addr) const {
+		return addr < reflen ? ref[addr] : 0xFF;	// Short reference: erased
+	}
+
+	void mismatch(unsigned addr) {
+		if ( !ranges.empty() && ranges.back().second == addr )
+			ranges.back().second = addr + 1;
+		else	ranges.push_back(std::make_pair(addr,addr + 1));
+		++differ;
+	}
+
+	void compare(unsigned from,unsigned to) {
+		for ( unsigned a = from; a < to; ++a )
+			if ( image[a] != expect(a) )
+				mismatch(a);
+		compared += to - from;
+	}
+
+	bool progress(const s_segment& seg,const s_updecoder& dec) {
+		unsigned upto = seg.offset + dec.contig;
+
+		if ( upto > pos ) {
+			compare(pos,upto);
+			pos = upto;
+		}
+		return !(abort_first && differ > 0);
+	}
+
+	// Compare the rest of a completed segment; missing bytes differ
+	void finish(const s_segment& seg,const s_updecoder& dec) {
+		for ( unsigned a = pos; a < seg.offset + dec.size; ++a ) {
+			if ( !dec.have[a - seg.offset] || image[a] != expect(a) )
+				mismatch(a);
+			++compared;
+		}
+		pos = seg.offset + dec.size;
+	}
+
+	void report() {
+		std::sort(ranges.begin(),ranges.end());
+
+		// Merge ranges that abut across segment boundaries
+		std::vector<std::pair<unsigned,unsigned> > merged;
+
+		for ( auto it = ranges.begin(); it != ranges.end(); ++it ) {
+			if ( !merged.empty() && merged.back().second >= it->first ) {
+				if ( it->second > merged.back().second )
+					merged.back().second = it->second;
+			} else	merged.push_back(*it);
+		}
+
+		for ( size_t x = 0; x < merged.size() && x < max_ranges; ++x )
+			printf("  Mismatch 0x%04X-0x%04X (%u bytes)\n",
+				merged[x].first,
+				merged[x].second - 1,
+				merged[x].second - merged[x].first);
+		if ( merged.size() > max_ranges )
+			printf("  ... and %u more ranges\n",unsigned(merged.size() - max_ranges));
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Upload each segment through the verifier. Returns false if it
+// stopped the read early: at a difference (abort_first), or at a
+// segment that did not read whole, which is left in v.unread and not
+// compared (its missing bytes say nothing about the chip).
+//////////////////////////////////////////////////////////////////////
+
+static bool
+verify_segments(s_unit& u,const s_eprom_type& etype,s_verifier& v,s_refimage *ref) {
+	std::vector<unsigned char> image(image_size(etype),0xFF);
+	s_updecoder dec;
+
+	v.image = image.data();		// Only valid during the read
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		if ( ref )
+			v.ref = ref->fetch(it->offset,etype.segsize);
+		v.pos = it->offset;
+		if ( !upload_segment(u,etype,*it,image.data(),dec,0,&v) )
+			return false;
+		if ( !dec.valid() ) {
+			v.unread = &*it;
+			v.why = dec.fault();
+			return false;
+		}
+		v.finish(*it,dec);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read the chip and compare it with the image in path. Returns the
+// exit status: 0 when every segment byte matches, 3 when a segment
+// could not be read, else 1.
+//////////////////////////////////////////////////////////////////////
+
+int
+verify_image(s_unit& u,const s_eprom_type& etype,const char *path,bool abort_first) {
+	const char *phase = perf_phase("verify");
+	size_t size = image_size(etype);
+	s_refimage ref;
+	s_verifier v;
+
+	ref.open(path);
+	if ( ref.size() != size )
+		fprintf(stderr,"WARNING: reference %s is %lu bytes, the %s is %lu%s\n",
+			path,
+			(unsigned long)ref.size(),
+			etype.name.c_str(),
+			(unsigned long)size,
+			ref.size() < size ? " (the rest must be erased)" : "");
+
+	v.ref = ref.bytes();
+	v.reflen = ref.size();
+	v.abort_first = abort_first;
+
+	if ( verbose )
+		printf("Verifying EPROM against '%s'\n",path);
+
+	bool aborted = !verify_segments(u,etype,v,&ref);
+
+	perf_phase(phase);
+
+	if ( v.unread ) {
+		printf("\nVerify FAILED: segment %s could not be read (%s)\n",
+			v.unread->ppname.c_str(),
+			v.why);
+		return 3;
+	}
+
+	if ( !v.differ ) {
+		printf("\nVerify OK: %lu bytes match %s\n",v.compared,path);
+		return 0;
+	}
+
+	printf("\nVerify FAILED: %lu of %lu bytes compared differ from %s%s\n",
+		v.differ,
+		v.compared,
+		path,
+		aborted ? " (stopped at the first difference)" : "");
+	v.report();
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Blank check: the chip must read all 0xFF. The read stops at the
+// first line holding a programmed byte. Returns the exit status: 0
+// blank, 1 not blank, 3 when a segment could not be read.
+//////////////////////////////////////////////////////////////////////
+
+int
+blank_check(s_unit& u,const s_eprom_type& etype) {
+	const char *phase = perf_phase("blank");
+	s_verifier v;
+
+	v.abort_first = true;			// No reference: all erased
+
+	if ( verbose )
+		printf("Blank checking EPROM\n");
+
+	bool full = verify_segments(u,etype,v,0);
+
+	perf_phase(phase);
+
+	if ( v.unread ) {
+		printf("\nBlank check FAILED: segment %s could not be read (%s)\n",
+			v.unread->ppname.c_str(),
+			v.why);
+		return 3;
+	}
+
+	if ( !v.differ ) {
+		printf("\nBlank check OK: all %lu bytes erased\n",v.compared);
+		return 0;
+	}
+
+	printf("\nNOT BLANK: programmed byte at 0x%04X%s\n",
+		v.ranges[0].first,
+		full ? "" : " (read stopped)");
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compare two image files (binary or .ppz), no device, segment by
+// segment. Where both are .ppz files indexing the segment, equal
+// CRCs settle it without decompressing either. Returns the exit
+// status: 0 when they are the same, else 1.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+same_by_index(const s_refimage& a,const s_refimage& b,unsigned addr,unsigned n) {
+
+	if ( !a.packed || !b.packed )
+		return false;
+
+	int xa = a.ppz.find(addr), xb = b.ppz.find(addr);
+
+	if ( xa < 0 || xb < 0 )
+		return false;
+
+	s_ppzseg sa = a.ppz.seg(xa), sb = b.ppz.seg(xb);
+
+	return sa.addr == addr && sb.addr == addr && sa.len == n && sb.len == n && sa.crc == sb.crc;
+}
+
+int
+diff_images(const s_eprom_type& etype,const char *path_a,const char *path_b) {
+	const char *phase = perf_phase("diff");
+	s_refimage a, b;
+	s_verifier v;
+	unsigned by_index = 0, segs_differ = 0;
+
+	a.open(path_a);
+	b.open(path_b);
+
+	for ( auto it = etype.segs.begin(); it != etype.segs.end(); ++it ) {
+		unsigned long before = v.differ;
+
+		if ( same_by_index(a,b,it->offset,etype.segsize) ) {
+			v.compared += etype.segsize;
+			++by_index;
+			continue;
+		}
+
+		a.fetch(it->offset,etype.segsize);
+		v.ref = b.fetch(it->offset,etype.segsize);
+		v.reflen = b.size();
+		for ( unsigned x = it->offset; x < it->offset + etype.segsize; ++x ) {
+			unsigned char byte = x < a.size() ? a.bytes()[x] : 0xFF;
+
+			if ( byte != v.expect(x) )
+				v.mismatch(x);
+			++v.compared;
+		}
+
+		if ( v.differ != before ) {
+			++segs_differ;
+			if ( verbose )
+				printf("Segment %s (0x%04X) differs in %lu bytes\n",
+					it->ppname.c_str(),
+					it->offset,
+					v.differ - before);
+		}
+	}
+
+	perf_phase(phase);
+
+	if ( !v.differ ) {
+		printf("Same: %lu bytes of %s match %s (%u of %u segments by index CRC)\n",
+			v.compared,
+			path_a,
+			path_b,
+			by_index,
+			unsigned(etype.segs.size()));
+		return 0;
+	}
+
+	printf("DIFFER: %lu of %lu bytes in %u of %u segments (%u by index CRC)\n",
+		v.differ,
+		v.compared,
+		segs_differ,
+		unsigned(etype.segs.size()),
+		by_index);
+	v.report();
+	return 1;
+}
+
+// End verify.cpp
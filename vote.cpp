@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////
+// vote.cpp -- Bitwise majority vote over repeated reads
+//
+// The kernels are bit sliced: a stack of vectors holds, for every bit
+// position at once, the count of passes that read it as 1 (vector k
+// holds bit k of each count). Each pass is added with a ripple carry
+// of ANDs and XORs, then the counts are compared with npass/2 from the
+// top bit down. The same code runs on 64-bit words, SSE2 and AVX2
+// vectors through the compiler's vector operators.
+///////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOTE_X86 1
+#endif
+
+#include "vote.hpp"
+
+static const unsigned count_bits = 5;		// Counts up to vote_max_passes
+
+template <typename V>
+static inline __attribute__((always_inline)) void
+vote_block(const unsigned char *const *pass,unsigned npass,size_t off,unsigned char *major,unsigned char *unstable) {
+	const unsigned half = npass / 2;
+	V c[count_bits], all, any, gt, eq;
+
+	memset(c,0,sizeof c);
+	memset(&all,0xFF,sizeof all);
+	memset(&any,0,sizeof any);
+
+	for ( unsigned p = 0; p < npass; ++p ) {
+		V carry;
+
+		memcpy(&carry,pass[p] + off,sizeof carry);
+		all &= carry;
+		any |= carry;
+		for ( unsigned k = 0; k < count_bits; ++k ) {
+			V t = c[k] & carry;
+
+			c[k] ^= carry;
+			carry = t;
+		}
+	}
+
+	// gt = count > half
+
+	memset(&gt,0,sizeof gt);
+	memset(&eq,0xFF,sizeof eq);
+	for ( int k = count_bits - 1; k >= 0; --k ) {
+		if ( half >> k & 1 ) {
+			eq &= c[k];
+		} else	{
+			gt |= eq & c[k];
+			eq &= ~c[k];
+		}
+	}
+
+	memcpy(major + off,&gt,sizeof gt);
+	any ^= all;
+	memcpy(unstable + off,&any,sizeof any);
+}
+
+static void
+vote_tail(const unsigned char *const *pass,unsigned npass,size_t x,size_t n,unsigned char *major,unsigned char *unstable) {
+
+	for ( ; x < n; ++x )
+		vote_block<unsigned char>(pass,npass,x,major,unstable);
+}
+
+static void
+vote_scalar(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable) {
+	size_t x = 0;
+
+	for ( ; x + 8 <= n; x += 8 )
+		vote_block<uint64_t>(pass,npass,x,major,unstable);
+	vote_tail(pass,npass,x,n,major,unstable);
+}
+
+#ifdef VOTE_X86
+
+static void
+vote_sse2(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable) {
+	size_t x = 0;
+
+	for ( ; x + 16 <= n; x += 16 )
+		vote_block<__m128i>(pass,npass,x,major,unstable);
+	vote_tail(pass,npass,x,n,major,unstable);
+}
+
+__attribute__((target("avx2")))
+static void
+vote_avx2(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable) {
+	size_t x = 0;
+
+	for ( ; x + 32 <= n; x += 32 )
+		vote_block<__m256i>(pass,npass,x,major,unstable);
+	vote_tail(pass,npass,x,n,major,unstable);
+}
+
+#endif // VOTE_X86
+
+//////////////////////////////////////////////////////////////////////
+// Kernel selection
+//////////////////////////////////////////////////////////////////////
+
+vote_fn
+vote_kernel(const char *name) {
+
+	if ( !strcmp(name,"scalar") )
+		return vote_scalar;
+#ifdef VOTE_X86
+	if ( !strcmp(name,"sse2") && __builtin_cpu_supports("sse2") )
+		return vote_sse2;
+	if ( !strcmp(name,"avx2") && __builtin_cpu_supports("avx2") )
+		return vote_avx2;
+#endif
+	return 0;
+}
+
+static const char *
+pick_best() {
+
+	if ( vote_kernel("avx2") )
+		return "avx2";
+	if ( vote_kernel("sse2") )
+		return "sse2";
+	return "scalar";
+}
+
+const char *
+vote_best() {
+	static const char *const best = pick_best();	// Once, thread safe
+
+	return best;
+}
+
+void
+vote(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable) {
+	static const vote_fn fn = vote_kernel(vote_best());	// Initialized once, thread safe
+
+	fn(pass,npass,n,major,unstable);
+}
+
+// End vote.cpp
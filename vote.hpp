@@ -0,0 +1,31 @@
+///////////////////////////////////////////////////////////////////////
+// vote.hpp -- Bitwise majority vote over repeated reads
+///////////////////////////////////////////////////////////////////////
+
+#ifndef VOTE_HPP
+#define VOTE_HPP
+
+#include <stddef.h>
+
+static const unsigned vote_max_passes = 31;
+
+//////////////////////////////////////////////////////////////////////
+// Combine npass (1..vote_max_passes) reads of n bytes. Each bit of
+// major[] is 1 when more than half of the passes read it as 1; a tie
+// gives 0, since an erased bit never reads 0 on its own. unstable[]
+// has the bits that did not read the same in every pass. The best
+// kernel for the CPU (AVX2, SSE2 or scalar) is chosen on first use.
+//////////////////////////////////////////////////////////////////////
+
+void vote(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable);
+
+// Individual kernels, for benchmarking (null when not supported):
+
+typedef void (*vote_fn)(const unsigned char *const *pass,unsigned npass,size_t n,unsigned char *major,unsigned char *unstable);
+
+vote_fn vote_kernel(const char *name);		// "scalar", "sse2", "avx2"
+const char *vote_best();			// Name of kernel in use
+
+#endif // VOTE_HPP
+
+// End vote.hpp